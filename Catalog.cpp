@@ -0,0 +1,295 @@
+/*
+ * Catalog.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Catalog.h"
+#include "ContentHash.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	const char CATALOG_MAGIC[8] = {'M','P','3','T','C','A','T','1'};
+	const boost::uint32_t CATALOG_VERSION = 2;
+	const size_t MAX_STRING = 0xffff;
+	const boost::uint64_t MAX_OFFSET = 0xffffffffULL;		//of strings and rows
+
+	struct catalog_header {
+		char magic[8];
+		boost::uint32_t version;
+		boost::uint32_t reserved;
+		boost::uint64_t key_count;
+		boost::uint64_t row_count;
+		boost::uint64_t strings_size;
+		boost::uint64_t checksum;		//XXH64 of keys, rows and strings
+	};
+
+	bool ByHash(const Catalog::key &a, const Catalog::key &b)
+	{
+		return a.hash < b.hash;
+	}
+
+	bool ByHashKindRow(const Catalog::key &a, const Catalog::key &b)
+	{
+		if(a.hash != b.hash)
+			return a.hash < b.hash;
+		if(a.kind != b.kind)
+			return a.kind < b.kind;
+		return a.row < b.row;
+	}
+
+	bool SameKey(const Catalog::key &a, const Catalog::key &b)
+	{
+		return a.hash == b.hash && a.kind == b.kind;
+	}
+
+	boost::uint64_t KeyHash(Catalog::KeyKind kind, const std::string &first, const std::string &second)
+	{
+		unsigned char k = (unsigned char)kind;
+		boost::uint64_t h = HashBytes(&k, 1);
+		h = HashBytes(first.data(), first.size(), h);
+		h = HashBytes("", 1, h);			//"ab" "c" is not "a" "bc"
+		return HashBytes(second.data(), second.size(), h);
+	}
+
+	//Strings are stored once, as a 16-bit length and the bytes; offset 0 is ""
+	class string_pool {
+	public:
+		string_pool() : _data(2, '\0') {}
+
+		//False once the offsets no longer fit 32 bits
+		bool Add(const std::string &s, boost::uint32_t &offset)
+		{
+			offset = 0;
+			if(s.empty())
+				return true;
+			std::string v = s.substr(0, MAX_STRING);
+			boost::unordered_map<std::string, boost::uint32_t>::const_iterator it = _offsets.find(v);
+			if(it != _offsets.end()) {
+				offset = it->second;
+				return true;
+			}
+			if(_data.size() > MAX_OFFSET)
+				return false;
+			offset = (boost::uint32_t)_data.size();
+			boost::uint16_t size = (boost::uint16_t)v.size();
+			_data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+			_data += v;
+			_offsets[v] = offset;
+			return true;
+		}
+
+		const std::string &data() const { return _data; }
+
+	private:
+		std::string _data;
+		boost::unordered_map<std::string, boost::uint32_t> _offsets;
+	};
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+Catalog::Catalog(const fs::path &file)
+: _file(file)
+, _keys(NULL)
+, _key_count(0)
+, _rows(NULL)
+, _row_count(0)
+, _strings(NULL)
+, _strings_size(0)
+, _checksum(0)
+{
+}
+
+Catalog::~Catalog()
+{
+}
+
+bool Catalog::Open()
+{
+	namespace ip = boost::interprocess;
+	try {
+		_mapping.reset(new ip::file_mapping(_file.string().c_str(), ip::read_only));
+		_region.reset(new ip::mapped_region(*_mapping, ip::read_only));
+	} catch (const ip::interprocess_exception& ex) {
+		LogError << _T("Cannot open catalog ") << _file.string<tstring>() << _T(": ") << ex.what() << std::endl;
+		_region.reset();
+		_mapping.reset();
+		return false;
+	}
+
+	boost::uint64_t size = _region->get_size();
+	const catalog_header *header = static_cast<const catalog_header*>(_region->get_address());
+	boost::uint64_t tables = size >= sizeof(catalog_header) ? size - sizeof(catalog_header) : 0;	//keys, rows, strings
+	if(size < sizeof(catalog_header) || memcmp(header->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0
+		|| header->version != CATALOG_VERSION
+		|| header->strings_size > tables
+		|| (tables - header->strings_size) / sizeof(key) < header->key_count
+		|| (tables - header->strings_size - header->key_count * sizeof(key)) / sizeof(row) < header->row_count) {
+		LogError << _T("Catalog ") << _file.string<tstring>() << _T(" is not valid") << std::endl;
+		_region.reset();
+		_mapping.reset();
+		return false;
+	}
+	_keys = reinterpret_cast<const key*>(header + 1);
+	_key_count = (size_t)header->key_count;
+	_rows = reinterpret_cast<const row*>(_keys + _key_count);
+	_row_count = (size_t)header->row_count;
+	_strings = reinterpret_cast<const char*>(_rows + _row_count);
+	_strings_size = (size_t)header->strings_size;
+	_checksum = header->checksum;
+	_region->advise(ip::mapped_region::advice_random);
+	return true;
+}
+
+bool Catalog::Find(const std::string &artist, const std::string &album, const std::string &title, catalog_entry &out) const
+{
+	const row *r = NULL;
+	bool by_title = Lookup(ArtistTitle, artist, title, r);
+	if(!by_title && !Lookup(ArtistAlbum, artist, album, r))
+		return false;
+	out.artist = TagLib::String(String(r->artist), TagLib::String::UTF8);
+	out.album = TagLib::String(String(r->album), TagLib::String::UTF8);
+	out.genre = TagLib::String(String(r->genre), TagLib::String::UTF8);
+	out.year = r->year;
+	//Found by album, the row is just one of its tracks
+	out.title = by_title ? TagLib::String(String(r->title), TagLib::String::UTF8) : TagLib::String();
+	out.track = by_title ? r->track : 0;
+	return true;
+}
+
+bool Catalog::Lookup(KeyKind kind, const std::string &first, const std::string &second, const row *&out) const
+{
+	std::string a = Normalize(first), b = Normalize(second);
+	if(a.empty() || b.empty())
+		return false;
+	key k;
+	k.hash = KeyHash(kind, a, b);
+	const key *end = _keys + _key_count;
+	for(const key *it = std::lower_bound(_keys, end, k, ByHash); it != end && it->hash == k.hash; ++it) {
+		if(it->kind != (boost::uint32_t)kind || it->row >= _row_count)
+			continue;
+		const row &r = _rows[it->row];
+		if(Normalize(String(r.artist)) == a && Normalize(String(kind == ArtistTitle ? r.title : r.album)) == b) {
+			out = &r;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string Catalog::String(boost::uint32_t offset) const
+{
+	boost::uint16_t size;
+	if(offset > _strings_size || _strings_size - offset < sizeof(size))
+		return std::string();
+	memcpy(&size, _strings + offset, sizeof(size));
+	if(_strings_size - offset - sizeof(size) < size)
+		return std::string();
+	return std::string(_strings + offset + sizeof(size), size);
+}
+
+std::string Catalog::Normalize(const std::string &utf8)
+{
+	std::string out;
+	out.reserve(utf8.size());
+	for(size_t i = 0; i < utf8.size(); ++i) {
+		unsigned char c = utf8[i];
+		if(c >= 'A' && c <= 'Z')
+			out += (char)(c + ('a' - 'A'));
+		else if((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80)
+			out += (char)c;
+	}
+	return out;
+}
+
+size_t Catalog::Build(std::istream &tsv, const fs::path &file)
+{
+	string_pool strings;
+	std::vector<row> rows;
+	std::vector<key> keys;
+	std::string line;
+	std::vector<std::string> columns;
+	while(std::getline(tsv, line)) {
+		if(!line.empty() && line[line.size()-1] == '\r')
+			line.erase(line.size()-1);
+		columns.clear();
+		for(size_t begin = 0;;) {
+			size_t tab = line.find('\t', begin);
+			columns.push_back(line.substr(begin, tab == std::string::npos ? std::string::npos : tab - begin));
+			if(tab == std::string::npos)
+				break;
+			begin = tab + 1;
+		}
+		if(columns.size() < 5 || columns[0].empty())
+			continue;
+		std::string artist = Normalize(columns[0]), album = Normalize(columns[1]), title = Normalize(columns[2]);
+		if(artist.empty() || (album.empty() && title.empty()))
+			continue;
+
+		row r;
+		if(rows.size() >= MAX_OFFSET || !strings.Add(columns[0], r.artist) || !strings.Add(columns[1], r.album)
+			|| !strings.Add(columns[2], r.title) || !strings.Add(columns[4], r.genre)) {
+			LogError << _T("Catalog too large: rows and strings are addressed by 32-bit offsets") << std::endl;
+			return 0;
+		}
+		r.year = (boost::uint16_t)std::max(0, std::min(atoi(columns[3].c_str()), 0xffff));
+		r.track = columns.size() > 5 ? (boost::uint16_t)std::max(0, std::min(atoi(columns[5].c_str()), 0xffff)) : 0;
+		key k;
+		k.row = (boost::uint32_t)rows.size();
+		if(!title.empty()) {
+			k.kind = ArtistTitle;
+			k.hash = KeyHash(ArtistTitle, artist, title);
+			keys.push_back(k);
+		}
+		if(!album.empty()) {
+			k.kind = ArtistAlbum;
+			k.hash = KeyHash(ArtistAlbum, artist, album);
+			keys.push_back(k);
+		}
+		rows.push_back(r);
+	}
+	std::sort(keys.begin(), keys.end(), ByHashKindRow);
+	keys.erase(std::unique(keys.begin(), keys.end(), SameKey), keys.end());
+
+	catalog_header header;
+	memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+	header.version = CATALOG_VERSION;
+	header.reserved = 0;
+	header.key_count = keys.size();
+	header.row_count = rows.size();
+	header.strings_size = strings.data().size();
+	xxh64 checksum;
+	if(!keys.empty())
+		checksum.update(&keys[0], keys.size() * sizeof(key));
+	if(!rows.empty())
+		checksum.update(&rows[0], rows.size() * sizeof(row));
+	checksum.update(strings.data().data(), strings.data().size());
+	header.checksum = checksum.digest();
+
+	fs::path tmp = file;
+	tmp += ".tmp";
+	{
+		std::ofstream out(tmp.string().c_str(), std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if(!keys.empty())
+			out.write(reinterpret_cast<const char*>(&keys[0]), keys.size() * sizeof(key));
+		if(!rows.empty())
+			out.write(reinterpret_cast<const char*>(&rows[0]), rows.size() * sizeof(row));
+		out.write(strings.data().data(), strings.data().size());
+		out.close();
+		if(!out) {
+			LogError << _T("Cannot write catalog ") << tmp.string<tstring>() << std::endl;
+			return 0;
+		}
+	}
+	fs::rename(tmp, file);
+	return rows.size();
+}
@@ -0,0 +1,95 @@
+/*
+ * Catalog.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#define TAGLIB_STATIC
+
+#include <istream>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <taglib/tag.h>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//A catalog row as the tags should hold it; empty and 0 where it says nothing
+struct catalog_entry {
+	TagLib::String artist;
+	TagLib::String album;
+	TagLib::String title;
+	TagLib::String genre;
+	TagLib::uint year;
+	TagLib::uint track;
+
+	catalog_entry() : year(0), track(0) {}
+};
+
+//Known recordings, looked up by the artist and title a file name gives, or
+//by its artist and album.
+//
+//Build() turns a tab separated dump (artist, album, title, year, genre and
+//optionally track) into an index file once: fixed-size keys sorted by the
+//hash of the normalized names, the rows they point to, and the strings of
+//the rows. Open() maps the file read-only, so there is nothing to parse at
+//startup and the workers search it without a lock.
+//
+//Names are compared normalized: ASCII letters in lower case and digits,
+//other ASCII dropped, so case, spacing and punctuation do not matter. A key
+//found is checked against the names of its row.
+class Catalog {
+public:
+	explicit Catalog(const fs::path &file);
+	~Catalog();
+
+	bool Open();
+	size_t size() const { return _row_count; }
+	//Of the contents, written by Build(); another catalog gives another value
+	boost::uint64_t checksum() const { return _checksum; }
+	//UTF-8 names, empty if the file name did not give them
+	bool Find(const std::string &artist, const std::string &album, const std::string &title, catalog_entry &out) const;
+
+	//Returns the rows written, 0 on failure; the first row of a key wins
+	static size_t Build(std::istream &tsv, const fs::path &file);
+	static std::string Normalize(const std::string &utf8);
+
+	enum KeyKind {ArtistTitle = 1, ArtistAlbum};
+	struct key {
+		boost::uint64_t hash;
+		boost::uint32_t row;
+		boost::uint32_t kind;
+	};
+	struct row {
+		boost::uint32_t artist;		//offsets of length-prefixed strings
+		boost::uint32_t album;
+		boost::uint32_t title;
+		boost::uint32_t genre;
+		boost::uint16_t year;
+		boost::uint16_t track;
+	};
+
+protected:
+	bool Lookup(KeyKind kind, const std::string &first, const std::string &second, const row *&out) const;
+	std::string String(boost::uint32_t offset) const;
+
+protected:
+	fs::path _file;
+	boost::scoped_ptr<boost::interprocess::file_mapping> _mapping;
+	boost::scoped_ptr<boost::interprocess::mapped_region> _region;
+	const key *_keys;
+	size_t _key_count;
+	const row *_rows;
+	size_t _row_count;
+	const char *_strings;
+	size_t _strings_size;
+	boost::uint64_t _checksum;
+};
+
+#endif /* CATALOG_H_ */
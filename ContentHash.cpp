@@ -0,0 +1,239 @@
+/*
+ * ContentHash.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "ContentHash.h"
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	const boost::uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+	const boost::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	const boost::uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+	const boost::uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+	const boost::uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+	inline boost::uint64_t Rotl(boost::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+	inline boost::uint64_t Read64(const unsigned char *p)
+	{
+		boost::uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline boost::uint32_t Read32(const unsigned char *p)
+	{
+		boost::uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline boost::uint64_t Round(boost::uint64_t acc, boost::uint64_t input)
+	{
+		return Rotl(acc + input * PRIME2, 31) * PRIME1;
+	}
+
+	inline boost::uint64_t MergeRound(boost::uint64_t acc, boost::uint64_t v)
+	{
+		return (acc ^ Round(0, v)) * PRIME1 + PRIME4;
+	}
+}
+
+xxh64::xxh64(boost::uint64_t seed)
+: _buffered(0)
+, _total(0)
+, _seed(seed)
+{
+	_v[0] = seed + PRIME1 + PRIME2;
+	_v[1] = seed + PRIME2;
+	_v[2] = seed;
+	_v[3] = seed - PRIME1;
+}
+
+void xxh64::update(const void *data, size_t size)
+{
+	const unsigned char *p = static_cast<const unsigned char*>(data);
+	const unsigned char *end = p + size;
+	_total += size;
+
+	if(_buffered + size < sizeof(_buffer)) {
+		memcpy(_buffer + _buffered, p, size);
+		_buffered += size;
+		return;
+	}
+	if(_buffered) {
+		size_t fill = sizeof(_buffer) - _buffered;
+		memcpy(_buffer + _buffered, p, fill);
+		p += fill;
+		for(int i = 0; i < 4; ++i)
+			_v[i] = Round(_v[i], Read64(_buffer + 8 * i));
+		_buffered = 0;
+	}
+	boost::uint64_t v0 = _v[0], v1 = _v[1], v2 = _v[2], v3 = _v[3];
+	for(; end - p >= 32; p += 32) {
+		v0 = Round(v0, Read64(p));
+		v1 = Round(v1, Read64(p + 8));
+		v2 = Round(v2, Read64(p + 16));
+		v3 = Round(v3, Read64(p + 24));
+	}
+	_v[0] = v0; _v[1] = v1; _v[2] = v2; _v[3] = v3;
+	memcpy(_buffer, p, end - p);
+	_buffered = end - p;
+}
+
+boost::uint64_t xxh64::digest() const
+{
+	boost::uint64_t h;
+	if(_total >= 32) {
+		h = Rotl(_v[0], 1) + Rotl(_v[1], 7) + Rotl(_v[2], 12) + Rotl(_v[3], 18);
+		for(int i = 0; i < 4; ++i)
+			h = MergeRound(h, _v[i]);
+	} else
+		h = _seed + PRIME5;
+	h += _total;
+
+	const unsigned char *p = _buffer;
+	const unsigned char *end = _buffer + _buffered;
+	for(; end - p >= 8; p += 8)
+		h = Rotl(h ^ Round(0, Read64(p)), 27) * PRIME1 + PRIME4;
+	if(end - p >= 4) {
+		h = Rotl(h ^ (Read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for(; p != end; ++p)
+		h = Rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	typedef std::vector<std::pair<boost::uint64_t, boost::uint64_t> > byte_ranges;	//[begin, end)
+
+	inline boost::uint32_t BigEndian32(const unsigned char *p)
+	{
+		return (boost::uint32_t)p[0] << 24 | (boost::uint32_t)p[1] << 16 | (boost::uint32_t)p[2] << 8 | p[3];
+	}
+
+	inline boost::uint32_t LittleEndian32(const unsigned char *p)
+	{
+		return (boost::uint32_t)p[3] << 24 | (boost::uint32_t)p[2] << 16 | (boost::uint32_t)p[1] << 8 | p[0];
+	}
+
+	//Between an ID3v2 tag at the front and ID3v1 and APEv2 tags at the back
+	bool MpegAudio(const unsigned char *data, boost::uint64_t size, byte_ranges &out)
+	{
+		boost::uint64_t begin = 0, end = size;
+		if(size >= 10 && memcmp(data, "ID3", 3) == 0) {
+			begin = 10 + ((data[6] & 0x7f) << 21 | (data[7] & 0x7f) << 14 | (data[8] & 0x7f) << 7 | (data[9] & 0x7f));
+			if(data[5] & 0x10)
+				begin += 10;		//footer
+			if(begin >= size)
+				return false;
+		}
+		if(end - begin >= 128 && memcmp(data + end - 128, "TAG", 3) == 0)
+			end -= 128;
+		if(end - begin >= 32 && memcmp(data + end - 32, "APETAGEX", 8) == 0) {
+			const unsigned char *footer = data + end - 32;
+			boost::uint64_t ape = LittleEndian32(footer + 12);		//items and footer
+			if(LittleEndian32(footer + 20) & 0x80000000u)
+				ape += 32;											//header
+			if(ape <= end - begin)
+				end -= ape;
+		}
+		if(begin == end)
+			return false;
+		out.push_back(std::make_pair(begin, end));
+		return true;
+	}
+
+	//After the metadata blocks
+	bool FlacAudio(const unsigned char *data, boost::uint64_t size, byte_ranges &out)
+	{
+		boost::uint64_t p = 4;
+		bool last = false;
+		while(!last) {
+			if(size - p < 4)
+				return false;
+			last = (data[p] & 0x80) != 0;
+			p += 4 + (BigEndian32(data + p) & 0xffffff);
+			if(p > size)
+				return false;
+		}
+		if(p == size)
+			return false;
+		out.push_back(std::make_pair(p, size));
+		return true;
+	}
+
+	//The payload of the top-level mdat atoms; tags live in moov
+	bool Mp4Audio(const unsigned char *data, boost::uint64_t size, byte_ranges &out)
+	{
+		boost::uint64_t p = 0;
+		while(size - p >= 8) {
+			boost::uint64_t atom = BigEndian32(data + p), header = 8;
+			if(atom == 1) {
+				if(size - p < 16)
+					return false;
+				atom = (boost::uint64_t)BigEndian32(data + p + 8) << 32 | BigEndian32(data + p + 12);
+				header = 16;
+			} else if(atom == 0)
+				atom = size - p;	//up to the end of the file
+			if(atom < header || atom > size - p)
+				return false;
+			if(memcmp(data + p + 4, "mdat", 4) == 0 && atom > header)
+				out.push_back(std::make_pair(p + header, p + atom));
+			p += atom;
+		}
+		return !out.empty();
+	}
+}
+
+bool AudioHash(const fs::path &file, boost::uint64_t &hash)
+{
+	namespace ip = boost::interprocess;
+	try {
+		ip::file_mapping mapping(file.string().c_str(), ip::read_only);
+		ip::mapped_region region(mapping, ip::read_only);
+		const unsigned char *data = static_cast<const unsigned char*>(region.get_address());
+		boost::uint64_t size = region.get_size();
+
+		byte_ranges audio;
+		bool found;
+		if(size >= 4 && memcmp(data, "fLaC", 4) == 0)
+			found = FlacAudio(data, size, audio);
+		else if(size >= 8 && memcmp(data + 4, "ftyp", 4) == 0)
+			found = Mp4Audio(data, size, audio);
+		else if((size >= 3 && memcmp(data, "ID3", 3) == 0) || (size >= 2 && data[0] == 0xFF && (data[1] & 0xE0) == 0xE0))
+			found = MpegAudio(data, size, audio);
+		else
+			found = false;
+		if(!found)
+			return false;
+
+		region.advise(ip::mapped_region::advice_sequential);
+		xxh64 h;
+		for(size_t i = 0; i < audio.size(); ++i)
+			h.update(data + audio[i].first, (size_t)(audio[i].second - audio[i].first));
+		hash = h.digest();
+		if(!hash)
+			hash = 1;
+		return true;
+	} catch (const ip::interprocess_exception&) {
+		return false;			//empty or unreadable
+	}
+}
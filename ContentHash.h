@@ -0,0 +1,37 @@
+/*
+ * ContentHash.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef CONTENTHASH_H_
+#define CONTENTHASH_H_
+
+#include <boost/cstdint.hpp>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//XXH64, fed piece by piece; 32 bytes a round in four independent lanes, so
+//it runs at memory speed rather than at the latency of one multiply chain
+class xxh64 {
+public:
+	explicit xxh64(boost::uint64_t seed = 0);
+	void update(const void *data, size_t size);
+	boost::uint64_t digest() const;
+
+private:
+	boost::uint64_t _v[4];
+	unsigned char _buffer[32];
+	size_t _buffered;
+	boost::uint64_t _total;
+	boost::uint64_t _seed;
+};
+
+//Hash of the audio of file, leaving out its tags: ID3v2 and ID3v1/APEv2 of
+//MP3s, the metadata blocks of FLAC, everything but the media data of MP4.
+//The file is mapped and read once front to back. False for other formats
+//and unreadable files; the hash is never 0.
+bool AudioHash(const fs::path &file, boost::uint64_t &hash);
+
+#endif /* CONTENTHASH_H_ */
@@ -0,0 +1,27 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+CPP_SRCS += \
+../bench/PatternBench.cpp \
+../bench/TagBench.cpp 
+
+BENCH_OBJS += \
+./bench/PatternBench.o \
+./bench/TagBench.o 
+
+CPP_DEPS += \
+./bench/PatternBench.d \
+./bench/TagBench.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+bench/%.o: ../bench/%.cpp
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C++ Compiler'
+	g++ -I/usr/include/boost -O0 -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
@@ -6,3 +6,5 @@ USER_OBJS :=
 
 LIBS := -lboost_program_options -lpthread -lboost_thread-mt -ltag -lboost_system -lboost_filesystem
 
+BENCH_LIBS := -lpthread -lboost_thread-mt -lboost_system -lboost_filesystem
+
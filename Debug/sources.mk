@@ -10,6 +10,7 @@ S_UPPER_SRCS :=
 OBJ_SRCS := 
 ASM_SRCS := 
 CXX_SRCS := 
+BENCH_OBJS := 
 C++_SRCS := 
 CC_SRCS := 
 OBJS := 
@@ -24,4 +25,5 @@ C_UPPER_DEPS :=
 # Every subdirectory with source files must be described here
 SUBDIRS := \
 . \
+bench \
 
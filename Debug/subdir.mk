@@ -4,17 +4,68 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
+../Catalog.cpp \
+../ContentHash.cpp \
+../DirectoryWalker.cpp \
+../DirectoryWatcher.cpp \
+../DuplicateTable.cpp \
 ../FileTagger.cpp \
+../HeadReader.cpp \
+../Id3v2.cpp \
+../Journal.cpp \
+../Metrics.cpp \
+../Pattern.cpp \
+../PatternSet.cpp \
+../Regex.cpp \
+../RunIndex.cpp \
+../TagBackend.cpp \
+../TagValues.cpp \
+../UndoLog.cpp \
+../Utf8.cpp \
 ../common.cpp \
 ../main.cpp 
 
 OBJS += \
+./Catalog.o \
+./ContentHash.o \
+./DirectoryWalker.o \
+./DirectoryWatcher.o \
+./DuplicateTable.o \
 ./FileTagger.o \
+./HeadReader.o \
+./Id3v2.o \
+./Journal.o \
+./Metrics.o \
+./Pattern.o \
+./PatternSet.o \
+./Regex.o \
+./RunIndex.o \
+./TagBackend.o \
+./TagValues.o \
+./UndoLog.o \
+./Utf8.o \
 ./common.o \
 ./main.o 
 
 CPP_DEPS += \
+./Catalog.d \
+./ContentHash.d \
+./DirectoryWalker.d \
+./DirectoryWatcher.d \
+./DuplicateTable.d \
 ./FileTagger.d \
+./HeadReader.d \
+./Id3v2.d \
+./Journal.d \
+./Metrics.d \
+./Pattern.d \
+./PatternSet.d \
+./Regex.d \
+./RunIndex.d \
+./TagBackend.d \
+./TagValues.d \
+./UndoLog.d \
+./Utf8.d \
 ./common.d \
 ./main.d 
 
@@ -0,0 +1,135 @@
+/*
+ * DirectoryWalker.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "DirectoryWalker.h"
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+DirectoryWalker::DirectoryWalker(path_callback on_file, path_callback on_directory, unsigned int threads)
+: _on_file(on_file)
+, _on_directory(on_directory)
+, _queued(0)
+, _pending(0)
+{
+	if(!threads)
+		threads = 1;
+	for(unsigned int i = 0; i < threads; ++i)
+		_stacks.push_back(new dir_stack);
+}
+
+DirectoryWalker::~DirectoryWalker()
+{
+	for(std::vector<dir_stack*>::iterator it = _stacks.begin(); it != _stacks.end(); ++it)
+		delete *it;
+}
+
+void DirectoryWalker::Walk(const fs::path &root)
+{
+	PushDirectory(0, root);
+
+	boost::thread_group threads;
+	for(size_t i = 0; i < _stacks.size(); ++i)
+		threads.create_thread(boost::bind(&DirectoryWalker::_thread_func, this, i));
+	threads.join_all();
+}
+
+void DirectoryWalker::_thread_func(size_t self)
+{
+	fs::path dir;
+	while(NextDirectory(self, dir)) {
+		ReadDirectory(self, dir);
+
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		if(--_pending == 0)
+			_cv.notify_all();		//tree exhausted, release the idle threads
+	}
+}
+
+void DirectoryWalker::PushDirectory(size_t self, const fs::path &dir)
+{
+	{
+		boost::lock_guard<boost::mutex> lock(_stacks[self]->mtx);
+		_stacks[self]->dirs.push_back(dir);
+	}
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	++_queued;
+	++_pending;
+	_cv.notify_one();
+}
+
+bool DirectoryWalker::NextDirectory(size_t self, fs::path &out)
+{
+	for(;;) {
+		//Own stack first, newest directory on top
+		{
+			dir_stack &own = *_stacks[self];
+			boost::lock_guard<boost::mutex> lock(own.mtx);
+			if(!own.dirs.empty()) {
+				out = own.dirs.back();
+				own.dirs.pop_back();
+				break;
+			}
+		}
+		//Steal the oldest (and likely largest) subtree from someone else
+		bool stolen = false;
+		for(size_t i = 1; i < _stacks.size() && !stolen; ++i) {
+			dir_stack &victim = *_stacks[(self + i) % _stacks.size()];
+			boost::lock_guard<boost::mutex> lock(victim.mtx);
+			if(!victim.dirs.empty()) {
+				out = victim.dirs.front();
+				victim.dirs.pop_front();
+				stolen = true;
+			}
+		}
+		if(stolen)
+			break;
+
+		boost::unique_lock<boost::mutex> lock(_mtx);
+		while(!_queued && _pending)
+			_cv.wait(lock);
+		if(!_pending)
+			return false;
+	}
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	--_queued;
+	return true;
+}
+
+void DirectoryWalker::ReadDirectory(size_t self, const fs::path &dir)
+{
+	//Time spent in the file callback, which may wait for a full work queue, is not reading
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	boost::posix_time::time_duration elsewhere;
+	try {
+		for (fs::directory_iterator end, it(dir); it != end; ++it) {
+			//The type of a plain entry is cached from the directory listing;
+			//only symlinks need a stat to be resolved
+			fs::file_status st = it->symlink_status();
+			if(fs::is_directory(st)) {
+				_on_directory(it->path());
+				PushDirectory(self, it->path());
+				continue;
+			}
+			if(fs::is_symlink(st))
+				st = it->status();
+
+			if(fs::is_regular_file(st)) {
+				boost::posix_time::ptime called = boost::posix_time::microsec_clock::universal_time();
+				_on_file(it->path());
+				elsewhere += boost::posix_time::microsec_clock::universal_time() - called;
+			} else if(fs::is_directory(st)) {
+				_on_directory(it->path());
+			} else {
+				LogError << _T("Error reading: ") << it->path().string<tstring>() << std::endl;
+			}
+		}
+	} catch (const fs::filesystem_error& ex) {
+		//An unreadable directory only loses its own subtree
+		LogError << ex.what() << std::endl;
+	}
+	if(_on_read)
+		_on_read(dir, (boost::posix_time::microsec_clock::universal_time() - start - elsewhere).total_microseconds());
+}
@@ -0,0 +1,61 @@
+/*
+ * DirectoryWalker.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef DIRECTORYWALKER_H_
+#define DIRECTORYWALKER_H_
+
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Parallel recursive directory enumeration.
+//Every directory is a task. Each thread keeps its own stack of directories and
+//works depth first from the top of it; an idle thread steals from the bottom of
+//another thread's stack. File types come from the directory entry itself
+//(d_type where the platform has it) so regular files cost no extra stat.
+//Symlinked directories are reported but not descended into.
+class DirectoryWalker {
+public:
+	typedef boost::function<void (const fs::path &)> path_callback;
+	typedef boost::function<void (const fs::path &, unsigned long long)> read_callback;	//directory, microseconds
+
+	DirectoryWalker(path_callback on_file, path_callback on_directory, unsigned int threads);
+	~DirectoryWalker();
+
+	//Optional, called after each directory has been read with the time it took,
+	//not counting the time spent in on_file
+	void SetReadCallback(read_callback on_read) { _on_read = on_read; }
+
+	//Blocks until the whole tree below root has been enumerated
+	void Walk(const fs::path &root);
+
+protected:
+	struct dir_stack {
+		boost::mutex mtx;
+		std::deque<fs::path> dirs;
+	};
+
+	void _thread_func(size_t self);
+	bool NextDirectory(size_t self, fs::path &out);
+	void PushDirectory(size_t self, const fs::path &dir);
+	void ReadDirectory(size_t self, const fs::path &dir);
+
+protected:
+	path_callback _on_file;
+	path_callback _on_directory;
+	read_callback _on_read;
+	std::vector<dir_stack*> _stacks;
+	//Termination
+	boost::mutex _mtx;
+	boost::condition_variable _cv;
+	size_t _queued;					//directories waiting on some stack
+	size_t _pending;				//directories queued or being read
+};
+
+#endif /* DIRECTORYWALKER_H_ */
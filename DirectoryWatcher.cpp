@@ -0,0 +1,239 @@
+/*
+ * DirectoryWatcher.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "DirectoryWatcher.h"
+#include <vector>
+
+#ifdef __linux__
+	#include <cerrno>
+	#include <cstring>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
+	#include <sys/inotify.h>
+#endif
+
+namespace pt = boost::posix_time;
+
+DirectoryWatcher::DirectoryWatcher(path_callback on_file, path_callback on_directory, unsigned int debounce_ms)
+: _on_file(on_file)
+, _on_directory(on_directory)
+, _debounce(pt::milliseconds(debounce_ms))
+, _recursive(false)
+, _fd(-1)
+{
+	_wake[0] = _wake[1] = -1;
+}
+
+#ifdef __linux__
+
+static const uint32_t DIRECTORY_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_ONLYDIR;
+//Blocking no longer than this, so a Stop() racing with poll() is noticed
+static const int MAX_POLL_MS = 1000;
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	if(_fd >= 0)
+		::close(_fd);
+	if(_wake[0] >= 0) {
+		::close(_wake[0]);
+		::close(_wake[1]);
+	}
+}
+
+bool DirectoryWatcher::IsSupported()
+{
+	return true;
+}
+
+bool DirectoryWatcher::Watch(const fs::path &root, bool recursive)
+{
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_fd < 0 || pipe(_wake) != 0) {
+		LogError << _T("Cannot watch: ") << strerror(errno) << std::endl;
+		return false;
+	}
+	fcntl(_wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(_wake[1], F_SETFL, O_NONBLOCK);
+
+	_root = root;
+	_recursive = recursive;
+	AddWatches(root);
+	if(_dirs.empty())
+		return false;
+	Log << _T("Watching ") << _dirs.size() << _T(" directories") << std::endl;
+	return true;
+}
+
+void DirectoryWatcher::AddWatches(const fs::path &root)
+{
+	std::vector<fs::path> stack(1, root);
+	while(!stack.empty()) {
+		fs::path dir = stack.back();
+		stack.pop_back();
+		int wd = inotify_add_watch(_fd, dir.c_str(), DIRECTORY_EVENTS);
+		if(wd < 0) {
+			LogError << _T("Cannot watch ") << dir.string<tstring>() << _T(": ") << strerror(errno)
+				<< (errno == ENOSPC ? _T(" (raise fs.inotify.max_user_watches)") : _T("")) << std::endl;
+			continue;
+		}
+		_dirs[wd] = dir;
+		if(!_recursive)
+			continue;
+		try {
+			for (fs::directory_iterator end, it(dir); it != end; ++it)
+				if(fs::is_directory(it->symlink_status()))	//symlinks are not followed, as in the walk
+					stack.push_back(it->path());
+		} catch (const fs::filesystem_error& ex) {
+			LogError << ex.what() << std::endl;
+		}
+	}
+}
+
+//A directory moved away: its watches still fire, but under the old path
+void DirectoryWatcher::RemoveWatches(const fs::path &dir)
+{
+	const tstring prefix = dir.string<tstring>() + tstring(1, fs::path::preferred_separator);
+	for(std::map<int, fs::path>::iterator it = _dirs.begin(); it != _dirs.end(); ) {
+		if(it->second == dir || it->second.string<tstring>().compare(0, prefix.size(), prefix) == 0) {
+			inotify_rm_watch(_fd, it->first);
+			_dirs.erase(it++);
+		} else
+			++it;
+	}
+}
+
+void DirectoryWatcher::Run()
+{
+	if(_fd < 0)
+		return;
+	for(;;) {
+		//Sleep until the next debounced file is due
+		int timeout = MAX_POLL_MS;
+		if(!_due.empty()) {
+			pt::ptime first = _due.begin()->second;
+			for(std::map<fs::path, pt::ptime>::const_iterator it = _due.begin(); it != _due.end(); ++it)
+				if(it->second < first)
+					first = it->second;
+			long long ms = (first - pt::microsec_clock::universal_time()).total_milliseconds();
+			timeout = ms < 0 ? 0 : (ms < MAX_POLL_MS ? (int)ms + 1 : MAX_POLL_MS);
+		}
+
+		struct pollfd fds[2];
+		fds[0].fd = _fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = _wake[0];
+		fds[1].events = POLLIN;
+		int n = poll(fds, 2, timeout);
+		if(n < 0 && errno != EINTR) {
+			LogError << _T("Watch failed: ") << strerror(errno) << std::endl;
+			return;
+		}
+		if(n > 0 && (fds[1].revents & POLLIN))
+			return;
+		if(n > 0 && (fds[0].revents & POLLIN))
+			HandleEvents();
+		DeliverDue();
+	}
+}
+
+void DirectoryWatcher::Stop()
+{
+	//write() is async-signal-safe
+	if(_wake[1] >= 0) {
+		char c = 0;
+		ssize_t ignored = ::write(_wake[1], &c, 1);
+		(void)ignored;
+	}
+}
+
+void DirectoryWatcher::HandleEvents()
+{
+	//Aligned for struct inotify_event
+	union {
+		struct inotify_event event;
+		char bytes[64 * 1024];
+	} buffer;
+	pt::ptime now = pt::microsec_clock::universal_time();
+
+	for(;;) {
+		ssize_t len = ::read(_fd, buffer.bytes, sizeof(buffer.bytes));
+		if(len <= 0)
+			return;					//EAGAIN: drained
+		for(char *p = buffer.bytes; p < buffer.bytes + len; ) {
+			const struct inotify_event *ev = reinterpret_cast<const struct inotify_event*>(p);
+			p += sizeof(struct inotify_event) + ev->len;
+
+			if(ev->mask & IN_Q_OVERFLOW) {
+				LogError << _T("Watch: events lost, rescanning ") << _root.string<tstring>() << std::endl;
+				_on_directory(_root);
+				continue;
+			}
+			if(ev->mask & IN_IGNORED) {	//watch removed, e.g. its directory was deleted
+				_dirs.erase(ev->wd);
+				continue;
+			}
+			std::map<int, fs::path>::const_iterator dir = _dirs.find(ev->wd);
+			if(dir == _dirs.end() || !ev->len)
+				continue;
+			fs::path path = dir->second / ev->name;
+
+			if(ev->mask & IN_ISDIR) {
+				if(!_recursive)
+					continue;
+				if(ev->mask & IN_MOVED_FROM)
+					RemoveWatches(path);
+				else if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+					AddWatches(path);
+					_on_directory(path);
+				}
+			} else if(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+				_due[path] = now + _debounce;	//a later event pushes the file back
+			} else if(ev->mask & IN_MOVED_FROM) {
+				_due.erase(path);
+			}
+		}
+	}
+}
+
+void DirectoryWatcher::DeliverDue()
+{
+	pt::ptime now = pt::microsec_clock::universal_time();
+	for(std::map<fs::path, pt::ptime>::iterator it = _due.begin(); it != _due.end(); ) {
+		if(it->second <= now) {
+			_on_file(it->first);
+			_due.erase(it++);
+		} else
+			++it;
+	}
+}
+
+#else
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+}
+
+bool DirectoryWatcher::IsSupported()
+{
+	return false;
+}
+
+bool DirectoryWatcher::Watch(const fs::path &, bool)
+{
+	LogError << _T("Watching directories is not supported on this platform") << std::endl;
+	return false;
+}
+
+void DirectoryWatcher::Run()
+{
+}
+
+void DirectoryWatcher::Stop()
+{
+}
+
+#endif
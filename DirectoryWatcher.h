@@ -0,0 +1,57 @@
+/*
+ * DirectoryWatcher.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef DIRECTORYWATCHER_H_
+#define DIRECTORYWATCHER_H_
+
+#include <map>
+#include <boost/function.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Reports files as they are finished in a directory tree (inotify, Linux only).
+//A file is reported once it was closed after writing or moved into the tree,
+//and no further event arrived for it during the debounce time. Directories
+//created or moved into the tree are watched too and reported once, so files
+//that landed before their watch existed are not missed. If the kernel's event
+//queue overflows the whole root is reported for a rescan.
+class DirectoryWatcher {
+public:
+	typedef boost::function<void (const fs::path &)> path_callback;
+
+	DirectoryWatcher(path_callback on_file, path_callback on_directory, unsigned int debounce_ms);
+	~DirectoryWatcher();
+
+	static bool IsSupported();
+
+	//Watches root, and everything below it if recursive
+	bool Watch(const fs::path &root, bool recursive);
+	//Delivers events until Stop() is called
+	void Run();
+	//Safe to call from a signal handler or another thread
+	void Stop();
+
+protected:
+	void AddWatches(const fs::path &dir);
+	void RemoveWatches(const fs::path &dir);
+	void HandleEvents();
+	void DeliverDue();
+
+protected:
+	path_callback _on_file;
+	path_callback _on_directory;
+	boost::posix_time::time_duration _debounce;
+	fs::path _root;
+	bool _recursive;
+	int _fd;						//inotify
+	int _wake[2];					//self-pipe for Stop()
+	std::map<int, fs::path> _dirs;	//watch descriptor -> directory
+	std::map<fs::path, boost::posix_time::ptime> _due;	//files waiting out the debounce
+};
+
+#endif /* DIRECTORYWATCHER_H_ */
@@ -0,0 +1,97 @@
+/*
+ * DuplicateTable.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "DuplicateTable.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+DuplicateTable::DuplicateTable()
+{
+}
+
+DuplicateTable::~DuplicateTable()
+{
+}
+
+bool DuplicateTable::Claim(boost::uint64_t hash, const fs::path &file, fs::path &original)
+{
+	shard &s = ShardOf(hash);
+	boost::lock_guard<boost::mutex> lock(s.mtx);
+	std::pair<boost::unordered_map<boost::uint64_t, entry>::iterator, bool> it =
+			s.entries.insert(std::make_pair(hash, entry()));
+	entry &e = it.first->second;
+	if(it.second) {
+		e.original = file;
+		return true;
+	}
+	if(e.original == file) {
+		e.state = Pending;			//tagged again, e.g. while watching
+		return true;
+	}
+	++e.copies;
+	original = e.original;
+	return false;
+}
+
+void DuplicateTable::Resolve(boost::uint64_t hash, const tag_values &values)
+{
+	Finish(hash, Resolved, &values);
+}
+
+void DuplicateTable::Abandon(boost::uint64_t hash)
+{
+	Finish(hash, Abandoned, NULL);
+}
+
+void DuplicateTable::Finish(boost::uint64_t hash, State state, const tag_values *values)
+{
+	shard &s = ShardOf(hash);
+	boost::lock_guard<boost::mutex> lock(s.mtx);
+	entry &e = s.entries[hash];
+	if(e.state != Pending)
+		return;
+	e.state = state;
+	if(values)
+		e.values = *values;
+	s.cv.notify_all();
+}
+
+//The original was claimed first, so a worker already has it; waiting cannot
+//hold up the files it depends on
+bool DuplicateTable::WaitResolved(boost::uint64_t hash, tag_values &values)
+{
+	shard &s = ShardOf(hash);
+	boost::unique_lock<boost::mutex> lock(s.mtx);
+	entry &e = s.entries[hash];
+	while(e.state == Pending)
+		s.cv.wait(lock);
+	if(e.state != Resolved)
+		return false;
+	values = e.values;
+	return true;
+}
+
+void DuplicateTable::Clear()
+{
+	for(size_t i = 0; i < SHARDS; ++i) {
+		boost::lock_guard<boost::mutex> lock(_shards[i].mtx);
+		_shards[i].entries.clear();
+	}
+}
+
+void DuplicateTable::Count(size_t &groups, size_t &copies) const
+{
+	groups = copies = 0;
+	for(size_t i = 0; i < SHARDS; ++i) {
+		const shard &s = _shards[i];
+		boost::lock_guard<boost::mutex> lock(s.mtx);
+		for(boost::unordered_map<boost::uint64_t, entry>::const_iterator it = s.entries.begin(); it != s.entries.end(); ++it)
+			if(it->second.copies) {
+				++groups;
+				copies += it->second.copies;
+			}
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * DuplicateTable.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef DUPLICATETABLE_H_
+#define DUPLICATETABLE_H_
+
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include "common.h"
+#include "TagValues.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Files of a run by audio hash, shared by the workers.
+//
+//The first file claiming a hash is its original: it goes through the whole
+//pipeline and, once its tags are decided, resolves the hash with them. Later
+//copies learn which file they duplicate and can wait for those tags instead
+//of matching their own names. An original that is rejected or fails abandons
+//the hash, and its copies are tagged on their own.
+//
+//The table is split into shards by hash, each with its own lock, so workers
+//claiming different hashes rarely meet.
+class DuplicateTable {
+public:
+	DuplicateTable();
+	~DuplicateTable();
+
+	//True for the first file with this hash; otherwise original is set
+	bool Claim(boost::uint64_t hash, const fs::path &file, fs::path &original);
+	void Resolve(boost::uint64_t hash, const tag_values &values);
+	void Abandon(boost::uint64_t hash);
+	//Blocks until the original resolved or abandoned the hash; false if abandoned
+	bool WaitResolved(boost::uint64_t hash, tag_values &values);
+
+	void Clear();
+	//Hashes seen more than once, and the copies beyond the first
+	void Count(size_t &groups, size_t &copies) const;
+
+protected:
+	enum State {Pending, Resolved, Abandoned};
+	struct entry {
+		fs::path original;
+		State state;
+		size_t copies;
+		tag_values values;			//once resolved
+
+		entry() : state(Pending), copies(0) {}
+	};
+	struct shard {
+		mutable boost::mutex mtx;
+		boost::condition_variable cv;
+		boost::unordered_map<boost::uint64_t, entry> entries;
+	};
+	static const size_t SHARDS = 64;
+
+	shard &ShardOf(boost::uint64_t hash) { return _shards[hash % SHARDS]; }
+	void Finish(boost::uint64_t hash, State state, const tag_values *values);
+
+protected:
+	shard _shards[SHARDS];
+};
+
+#endif /* DUPLICATETABLE_H_ */
@@ -6,366 +6,350 @@
  */
 
 #include "FileTagger.h"
+#include "ContentHash.h"
+#include "DirectoryWalker.h"
+#include "Utf8.h"
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include <iostream>
 #include <cstring>
+#include <fstream>
 
-tstring FieldTypeToString(FieldType type)
-{
-	tstring str_type;
-	switch(type)
+//////////////////////////////////////////////////////////////////////////////////
+
+//Holds the first claim of an audio hash while TagFile() decides the tags;
+//copies waiting for them are let go if it returns without
+class duplicate_claim {
+public:
+	duplicate_claim() : _table(NULL), _hash(0) {}
+	~duplicate_claim()
 	{
-		case Title:
-			str_type = _T("Title";)
-			break;
-		case Artist:
-			str_type = _T("Artist");
-			break;
-		case Album:
-			str_type = _T("Album");
-			break;
-		case Genre:
-			str_type = _T("Genre");
-			break;
-		case Comment:
-			str_type = _T("Comment");
-			break;
-		case TrackNo:
-			str_type = _T("Track#");
-			break;
-		case Year:
-			str_type = _T("Year");
-			break;
-		case Delimiter:
-			str_type = _T("Delimiter");
-			break;
-		case Ignore:
-			str_type = _T("Ignore");
-			break;
-		default:
-			str_type = _T("_Unknown");
-			break;
+		if(_table)
+			_table->Abandon(_hash);
 	}
-	return str_type;
+	void Hold(DuplicateTable *table, boost::uint64_t hash) { _table = table; _hash = hash; }
+	bool held() const { return _table != NULL; }
+	void Resolve(const tag_values &values)
+	{
+		_table->Resolve(_hash, values);
+		_table = NULL;
+	}
+private:
+	DuplicateTable *_table;
+	boost::uint64_t _hash;
+};
+
+//Tags a duplicate like its original; true if they differed
+static bool SetValues(TagLib::Tag *tag, const tag_values &values, bool write)
+{
+	if(tag_values(tag) == values)
+		return false;
+	if(write)
+		values.ApplyTo(tag);
+	return true;
 }
 
-//////////////////////////////////////////////////////////////////////////////////
-std::string Field::content_narrow;
+//Files waiting for a worker; the walk blocks once this many are queued
+static const size_t WORK_QUEUE_CAPACITY = 1024;
+//How often the queue depth and busy workers are sampled
+static const long SAMPLE_INTERVAL_MS = 1000;
 
-Field::Field(tstring content, FieldType type)
-: _content(content)
-, _type(type)
+FileTagger::FileTagger(PatternSet &p, bool replace_non_empty)
+: _patterns(p)
+, _safe(false)
+, _replace(replace_non_empty)
+, _direct_id3(true)
+, _sniff(false)
+, _padding(Id3v2Tag::DEFAULT_PADDING)
+, _async_reads(false)
+, _mapped_reads(false)
+, _prefetch(0)
+, _dedup_tags(false)
+, _settings_hash(0)
+, _threads_max(1)
+, _task_timeout(0)
+, _work_queue(WORK_QUEUE_CAPACITY)
+, _watcher(NULL)
+, _metrics_interval(10)
+, _sampler(NULL)
+, _sampler_stop(false)
 {
+
 }
 
-Field::~Field()
+FileTagger::~FileTagger()
 {
+	StopSampler();
+	StopWorkers();
 }
 
-const char* Field::ToCharArr(std::string &src)
+void FileTagger::SetEmptyFieldConstraint(std::vector<tstring> &empty_fields)
 {
-	return src.c_str();
+	_empty_fields = empty_fields;
 }
 
-const char* Field::ToCharArr(std::wstring &src)
+void FileTagger::SetSafeMode(bool safe_mode)
 {
-	content_narrow.reserve(src.size());
-	// wide to UTF-8
-	content_narrow.assign(src.begin(), src.end());
-	return content_narrow.c_str();
+	_safe = safe_mode;
 }
 
-const char* Field::ToCharArr()
+void FileTagger::SetIndexFile(tstring path)
 {
-	return ToCharArr(_content);
+	_index.reset(new RunIndex(fs::path(path)));
+	Log << _T("Index: ") << _index->size() << _T(" files from previous runs") << std::endl;
 }
-//////////////////////////////////////////////////////////////////////////////////
 
-Pattern::Pattern(tstring format, bool trim)
-: _pattern(format)
-, _trim(trim)
+bool FileTagger::SetCatalog(tstring path)
 {
-	_valid = parse();
+	_catalog.reset(new Catalog(fs::path(path)));
+	if(!_catalog->Open()) {
+		_catalog.reset();
+		return false;
+	}
+	Log << _T("Catalog: ") << _catalog->size() << _T(" recordings") << std::endl;
+	return true;
 }
 
-Pattern::~Pattern()
+void FileTagger::SetJournalFile(tstring path)
 {
+	_journal.reset(new Journal(fs::path(path)));
 }
 
-//A valid pattern is:
-//A sequence of one or more known fields (<Artist> ...)
-//separated by any delimiter string
-
-bool Pattern::parse()
+void FileTagger::SetUndoLog(tstring path)
 {
-	_nNamedFields = 0;
-	_nDelFields = 0;
-	_nPathSeparators = 0;
-	_structure.clear();
-	_delimiters_generic.clear();
-
-	//Find all occurrences of the allowed fields
-	Field title(_T("<Title>"), Title);
-	_nNamedFields += find_in_pattern(title);
-
-	Field artist(_T("<Artist>"), Artist);
-	_nNamedFields += find_in_pattern(artist);
-
-	Field album(_T("<Album>"), Album);
-	_nNamedFields += find_in_pattern(album);
-
-	Field genre(_T("<Genre>"), Genre);
-	_nNamedFields += find_in_pattern(genre);
-
-	Field comment(_T("<Comment>"), Comment);
-	_nNamedFields += find_in_pattern(comment);
-
-	Field trackno(_T("<Track#>"), TrackNo);
-	_nNamedFields += find_in_pattern(trackno);
-
-	Field year(_T("<Year>"), Year);
-	_nNamedFields += find_in_pattern(year);
-
-	Field ignore(_T("<Ignore>"), Ignore);
-	_nNamedFields += find_in_pattern(ignore);
+	_undo.reset(new UndoLog(fs::path(path)));
+}
 
-	//Everything else must be delimiters
-	size_t prev_pos = 0;
-	size_t prev_size= 0;
-	size_t pos = 0;
-	size_t size = 0;
-	position_map::iterator it = _structure.begin();
-	for(; it != _structure.end(); ++it)
-	{
-		pos = it->first;
-		size = it->second.size();
+void FileTagger::SetDuplicates(bool detect, bool propagate)
+{
+	_duplicates.reset(detect || propagate ? new DuplicateTable() : NULL);
+	_dedup_tags = propagate;
+}
 
-		if(!parse_helper(pos, size, prev_pos, prev_size)) {
-			throw Exc("Invalid pattern: Adjacent fields without a delimiter.");
-			return false;
-		}
+void FileTagger::SetMetricsFile(tstring path, unsigned int interval_seconds)
+{
+	_metrics_file = fs::path(path);
+	_metrics_interval = interval_seconds ? interval_seconds : 1;
+}
 
-		//Update previous
-		prev_pos = pos;
-		prev_size = size;
+void FileTagger::SaveIndex()
+{
+	//A dry run must not mark files as done
+	if(!_index || _safe)
+		return;
+	try {
+		_index->Save();
+	} catch (const fs::filesystem_error& ex) {
+		LogError << ex.what() << std::endl;
 	}
+}
 
-	bool tail = _pattern.size() > (pos + size);
-	if(tail) parse_helper(_pattern.size(), 0, pos, size);
-
+unsigned long long FileTagger::SettingsHash() const
+{
+	unsigned long long h = HashBytes(&_replace, sizeof(_replace));
+	h = HashBytes(&_dedup_tags, sizeof(_dedup_tags), h);
+	if(_catalog) {
+		boost::uint64_t contents = _catalog->checksum();
+		h = HashBytes(&contents, sizeof(contents), h);
+	}
+	for(size_t i = 0; i < _patterns.size(); ++i)
+		h = _patterns[i].hash(h);
+	for(std::vector<tstring>::const_iterator it = _empty_fields.begin(); it != _empty_fields.end(); ++it)
+		h = HashBytes(it->data(), it->size() * sizeof(char_type), h);
+	return h;
+}
 
-	_structure.insert(_delimiters_generic.begin(), _delimiters_generic.end());
-	return true;
+void FileTagger::PrintSummary() const
+{
+	_metrics.Print();
 }
 
-int Pattern::find_in_pattern(Field needle)
+void FileTagger::SetThreadCount(unsigned int count)
 {
-	return find_insert_field(needle, _pattern, _structure);
+	StopWorkers();
+	_threads_max = count ? count : 1;
+	StartWorkers();
 }
 
-int Pattern::find_insert_field(Field needle, tstring &haystack, position_map &out)
+
+void FileTagger::Tag(tstring path, bool recursive)
 {
-	int count = 0;
+	BeginRun();
+	TagPath(fs::path(path), recursive);
+	EndRun();
+}
 
-	size_t pos = haystack.find(needle._content, 0);
-	while(pos != tstring::npos)
-	{
-		++count;
-		out.insert(std::pair<size_t,Field>(pos, needle));
-	    pos = haystack.find(needle._content,pos+1);
+void FileTagger::TagList(std::basic_istream<char_type> &in, char_type delimiter, bool recursive)
+{
+	BeginRun();
+	tstring line;
+	while(std::getline(in, line, delimiter)) {
+		if(delimiter == _T('\n') && !line.empty() && line[line.size()-1] == _T('\r'))
+			line.erase(line.size()-1);
+		if(line.empty())
+			continue;
+		TagPath(fs::path(line), recursive);
 	}
-	return count;
+	EndRun();
 }
 
-bool Pattern::parse_helper(size_t pos, size_t size, size_t prev_pos, size_t prev_size)
+bool FileTagger::Watch(tstring path, bool recursive, unsigned int debounce_ms)
 {
-	size_t del_start = prev_pos + prev_size;
-	size_t del_end = pos;
-	if(del_end <= del_start) {
-		if(del_start ==0) {
-			//Update previous
-			prev_pos = pos;
-			prev_size = size;
-			return true;
-		}
+	DirectoryWatcher watcher(boost::bind(&FileTagger::OnWatchFile, this, _1),
+			boost::bind(&FileTagger::OnWatchDirectory, this, _1, recursive), debounce_ms);
+	if(!watcher.Watch(fs::path(path), recursive))
 		return false;
-	}
-	tstring delimiter = _pattern.substr(del_start, del_end-del_start);
-	if(_trim) {
-		boost::algorithm::trim_if(delimiter, boost::is_any_of(_trim_chars));
-		if(delimiter.size() < 1)
-			return false;
-	}
-	Field del(delimiter, Delimiter);
-	_delimiters_generic.insert(std::pair<size_t,Field>(del_start, del));
-	++_nDelFields;
-	if(delimiter==_T("/") || delimiter==_T("\\"))
-		++_nPathSeparators;
+	BeginRun();
+	//A few debounce times for the event of a write to come back
+	_handled_ttl = std::max(boost::posix_time::time_duration(boost::posix_time::milliseconds(debounce_ms) * 4),
+			boost::posix_time::time_duration(boost::posix_time::seconds(1)));
+	_watcher = &watcher;
+	watcher.Run();
+	_watcher = NULL;
+	EndRun();
+	_handled.clear();
 	return true;
 }
 
-bool Pattern::match(tstring &file_str, position_map &out) const
+bool FileTagger::Revert(tstring log)
 {
-	typedef std::vector<std::pair<size_t,size_t> > intervals;
-	intervals field_intervals;
-	position_map delimiters;
-	size_t pos = 0;
-	//Ensure sequence of delimiters exists
-	for(position_map::const_iterator it = _delimiters_generic.begin(); it != _delimiters_generic.end(); ++it)
-	{
-		const Field &field = it->second;
-		pos = file_str.find(field._content, pos);
-		if(pos == tstring::npos) {
-			Log << _T("Rejected: Delimiter `") << field._content << _T("` not found\n\n");
-			return false;
-		}
-		delimiters.insert(std::pair<size_t,Field>(pos, field));	//insert delimiter
-		++pos;
-	}
-
-	//Extract non-delimiter field ranges
-	size_t idx_start = 0;
-	size_t idx_end = 0;
-	for(position_map::iterator it = delimiters.begin(); it != delimiters.end(); ++it)
-	{
-		idx_end = it->first;
-		Field &field = it->second;
-		if(idx_end-idx_start > 0) {
-			field_intervals.push_back(std::pair<size_t,size_t>(idx_start, idx_end));
-		}
-		idx_start = idx_end+field.size();
-	}
-	//check tail
-	if(idx_start != file_str.size())
-		field_intervals.push_back(std::pair<size_t,size_t>(idx_start, file_str.size()));
-
-	if(_nNamedFields != field_intervals.size()) {
-		Log << _T("Rejected: Field count mismatch\n\n");
+	UndoLog undo((fs::path(log)));
+	if(!undo.Load())
 		return false;
+	Log << _T("Undo log: ") << undo.size() << _T(" files to revert") << std::endl;
+	BeginRun();
+	for(size_t i = 0; i < undo.size(); ++i) {
+		file_task task;
+		task.prefetched = true;		//the path is only known to the worker
+		task.undo = &undo;
+		task.entry = i;
+		_work_queue.push(task);
 	}
-	//Extract fields
-	int n = 0;
-	for(position_map::const_iterator it = _structure.begin(); it != _structure.end(); ++it)
-	{
-		Field field = it->second;
-		if(field._type == Delimiter)
-			continue;
-		std::pair<size_t,size_t> interval = field_intervals[n]; ++n;
-		field._content = file_str.substr(interval.first, interval.second-interval.first);
-		if(_trim)
-			boost::algorithm::trim_if(field._content, boost::is_any_of(_trim_chars));
-
-		out.insert(std::pair<size_t,Field>(interval.first, field));
-	}
+	EndRun();
 	return true;
 }
 
-void Pattern::print() const
+void FileTagger::StopWatching()
 {
-	if(!_valid) {
-		Log << _T("Pattern::print(): Invalid pattern") << std::endl;
-		return;
-	}
-	Log << _T("Trim=") << _trim << std::endl;
-	
-	for(position_map::const_iterator it = _structure.begin(); it != _structure.end(); ++it)
-	{
-		LogType mylog;
-		size_t pos = it->first;
-		const Field &field = it->second;
-		mylog << _T("Type ") << FieldTypeToString(field._type);
-		if(field._type == Delimiter)
-			mylog << _T("`") << field._content << _T("`");
-		mylog << _T(" at pos= ") << pos << std::endl;
-	}
-
+	DirectoryWatcher *watcher = _watcher;
+	if(watcher)
+		watcher->Stop();
 }
 
-bool Pattern::begins_with_separator()
+//Files written longer ago than their event could take; under _handled_mtx
+void FileTagger::ForgetHandled(boost::system_time now)
 {
-	if(!_structure.empty() &&
-			_structure.begin()->second._type == Delimiter &&
-			(_structure.begin()->second._content == _T("/") ||
-					_structure.begin()->second._content == _T("\\")))
-		return true;
-	return false;
+	for(std::map<fs::path, handled_file>::iterator it = _handled.begin(); it != _handled.end(); )
+		if(now - it->second.at > _handled_ttl)
+			_handled.erase(it++);
+		else
+			++it;
 }
 
-//////////////////////////////////////////////////////////////////////////////////
-
-FileTagger::FileTagger(Pattern &p, bool replace_non_empty)
-: _pattern(p)
-, _safe(false)
-, _replace(replace_non_empty)
-, _threads_max(1)
+void FileTagger::OnWatchFile(const fs::path &p)
 {
-
+	//Gone again, or replaced by a directory, before the debounce ran out
+	boost::system::error_code ec;
+	if(!fs::is_regular_file(p, ec))
+		return;
+	//The tagger's own writes are reported too; a file still as the worker
+	//wrote it has nothing new. Its one event is expected within the debounce
+	file_stat st;
+	if(StatFile(p, st)) {
+		boost::mutex::scoped_lock lock(_handled_mtx);
+		ForgetHandled(boost::get_system_time());
+		std::map<fs::path, handled_file>::iterator it = _handled.find(p);
+		if(it != _handled.end()) {
+			bool own = it->second.stat == st;
+			_handled.erase(it);
+			if(own) {
+				LogDebug << _T("Unchanged since tagged: ") << p.string<tstring>() << std::endl;
+				return;
+			}
+		}
+	}
+	const TagBackend *backend = BackendFor(p, false);
+	if (!backend) {
+		_metrics.Add(RunMetrics::SkippedExtension);
+		return;
+	}
+	TagFileOnThread(p, backend);
 }
 
-FileTagger::~FileTagger()
+//A directory appeared with possibly some files already in it
+void FileTagger::OnWatchDirectory(const fs::path &p, bool recursive)
 {
-
+	TagPath(p, recursive);
 }
 
-void FileTagger::SetEmptyFieldConstraint(std::vector<tstring> &empty_fields)
+void FileTagger::BeginRun()
 {
-	_empty_fields = empty_fields;
+	if(_threads.empty())
+		StartWorkers();
+	_settings_hash = SettingsHash();
+	if(_journal && !_safe && !_journal->Open(_settings_hash))
+		throw Exc("Cannot open the journal");
+	if(_undo && !_safe && !_undo->OpenForAppend())
+		throw Exc("Cannot open the undo log");
+	if(_duplicates)
+		_duplicates->Clear();
+	_metrics.Start(_threads_max);
+	//Only the direct path can use what is read ahead
+	if(_async_reads && _direct_id3) {
+		_reader.reset(new HeadReader(boost::bind(&FileTagger::OnHeadRead, this, _1, _2)));
+		if(!_reader->Start())
+			_reader.reset();
+	}
+	StartSampler();
 }
 
-void FileTagger::SetSafeMode(bool safe_mode)
+void FileTagger::EndRun()
 {
-	_safe = safe_mode;
+	//Files already queued are still processed if the walk failed half way
+	if(_reader) {
+		_reader->Drain();
+		_reader.reset();
+	}
+	_work_queue.wait_idle();
+	if(_journal)
+		_journal->Close();
+	if(_undo)
+		_undo->Close();
+	if(_duplicates) {
+		size_t groups, copies;
+		_duplicates->Count(groups, copies);
+		Log << _T("Duplicates: ") << copies << _T(" copies of ") << groups << _T(" files") << std::endl;
+	}
+	StopSampler();
 }
 
-
-void FileTagger::Tag(tstring path, bool recursive)
+void FileTagger::TagPath(const fs::path &path_to_dir_or_file, bool recursive)
 {
-	_done = false;
-	fs::path path_to_dir_or_file = fs::path(path);
 	try
 	{
-		if (!fs::exists(path_to_dir_or_file)) {
-			Log << _T("Invalid path: ") << path_to_dir_or_file.string<tstring>() << std::endl;
-			return;
-		}
-
-		if(fs::is_directory(path_to_dir_or_file))
+		//One stat per path; a streamed list can be long
+		fs::file_status st = fs::status(path_to_dir_or_file);
+		if(fs::is_directory(st))
 		{
-			recursive ? TagDirectoryRecursive(path) : TagDirectory(path);
+			recursive ? TagDirectoryRecursive(path_to_dir_or_file) : TagDirectory(path_to_dir_or_file);
 		}
-		else if (fs::is_regular_file(path_to_dir_or_file))
+		else if (fs::is_regular_file(st))
 		{
-				TagFileOnThread(path_to_dir_or_file);
-		}
-		else
-			Log << _T("Invalid path: ") << path_to_dir_or_file.string<tstring>() << std::endl;
-
-		_done = true;
-
-		while(!_threads.empty()) {
-			for(threadlist::const_iterator it = _threads.begin(); it !=_threads.end();)
-			{
-				boost::thread* thread = it->first;
-				time_t last_alive = it->second;
-				threadlist::const_iterator it_prev = it;
-				++it;
-				if(thread->timed_join(boost::posix_time::milliseconds(0))) {
-					_threads.remove(*it_prev);
-					continue;
-				}
-				if(last_alive < time(NULL) - 5) {	//consider dead
-					//terminate
-					HardKill(thread);
-					_threads.remove(*it_prev);
-					NewThread();
-					continue;
-				}
+			//A file named on its own is looked into whatever its extension
+			const TagBackend *backend = BackendFor(path_to_dir_or_file, true);
+			if(backend)
+				TagFileOnThread(path_to_dir_or_file, backend);
+			else {
+				_metrics.Add(RunMetrics::SkippedExtension);
+				LogError << _T("Unknown format: ") << path_to_dir_or_file.string<tstring>() << std::endl;
 			}
-			boost::this_thread::sleep(boost::posix_time::milliseconds(100));
 		}
+		else
+			LogError << _T("Invalid path: ") << path_to_dir_or_file.string<tstring>() << std::endl;
 
 	} catch (const fs::filesystem_error& ex) {
-		Log << ex.what() << std::endl;
+		LogError << ex.what() << std::endl;
 	}
 }
 
@@ -374,33 +358,36 @@ void FileTagger::TagDirectory(fs::path files_dir)
 
 	try {
 		if (!fs::exists(files_dir) || !fs::is_directory(files_dir)) {
-			Log << _T("Invalid directory: ") << files_dir.string<tstring>() << std::endl;
+			LogError << _T("Invalid directory: ") << files_dir.string<tstring>() << std::endl;
 			return;
 		}
 
+		stage_timer timer(_metrics, RunMetrics::Traversal);
 		for (fs::directory_iterator end, dir(files_dir); dir != end;
 				++dir) {
 			fs::path p = dir->path();
-
-			if (fs::is_regular_file(p)) {
-				tstring extension = p.extension().string<tstring>();
-				boost::algorithm::to_lower(extension);
-				if (extension != _T(".mp3")) {
-					Log << _T("Skipping ") <<  p.string<tstring>() << std::endl;
-					continue;
-				}
-				
-				TagFileOnThread(p);
-
-			} else if (fs::is_directory(p)) {
-				Log << _T("Directory: ") << p.string<tstring>() << std::endl;
+			fs::file_status st = dir->status();	//cached from the listing, no stat for plain files
+
+			if (fs::is_regular_file(st)) {
+				//Only the listing counts as traversal, not sniffing or a full work queue
+				timer.pause();
+				const TagBackend *backend = BackendFor(p, false);
+				if (!backend) {
+					_metrics.Add(RunMetrics::SkippedExtension);
+					LogDebug << _T("Skipping ") <<  p.string<tstring>() << std::endl;
+				} else
+					TagFileOnThread(p, backend);
+				timer.resume();
+
+			} else if (fs::is_directory(st)) {
+				LogDebug << _T("Directory: ") << p.string<tstring>() << std::endl;
 
 			} else {
-				Log << _T("Error reading: ") << p.string<tstring>() << std::endl;
+				LogError << _T("Error reading: ") << p.string<tstring>() << std::endl;
 			}
 		}
 	} catch (const fs::filesystem_error& ex) {
-		Log << ex.what() << std::endl;
+		LogError << ex.what() << std::endl;
 	}
 }
 
@@ -409,164 +396,659 @@ void FileTagger::TagDirectoryRecursive(fs::path files_dir)
 
 	try {
 		if (!fs::exists(files_dir) || !fs::is_directory(files_dir)) {
-			Log << _T("Invalid directory: ") << files_dir.string<tstring>() << std::endl;
+			LogError << _T("Invalid directory: ") << files_dir.string<tstring>() << std::endl;
 			return;
 		}
 
-		for (fs::recursive_directory_iterator end, dir(files_dir); dir != end;
-				++dir) {
-			fs::path p = dir->path();
+		//Subdirectories are read in parallel; files go to the workers as they are found
+		DirectoryWalker walker(boost::bind(&FileTagger::OnWalkFile, this, _1),
+				boost::bind(&FileTagger::OnWalkDirectory, this, _1), _threads_max);
+		walker.SetReadCallback(boost::bind(&FileTagger::OnReadDirectory, this, _1, _2));
+		walker.Walk(files_dir);
+
+	} catch (const fs::filesystem_error& ex) {
+		LogError << ex.what() << std::endl;
+	}
+}
 
-			if (fs::is_regular_file(p)) {
+void FileTagger::OnWalkFile(const fs::path &p)
+{
+	const TagBackend *backend = BackendFor(p, false);
+	if (!backend) {
+		_metrics.Add(RunMetrics::SkippedExtension);
+		return;
+	}
 
-				if (p.extension().string<tstring>() != _T(".mp3"))
-					continue;
+	TagFileOnThread(p, backend);
+}
 
-				TagFileOnThread(p);
+//By extension; the contents are read for files named on their own, and for
+//every file of an unknown extension with sniffing on
+const TagBackend *FileTagger::BackendFor(const fs::path &file, bool named) const
+{
+	const TagBackend *backend = TagBackend::ForFile(file);
+	if(!backend && (named || _sniff))
+		backend = TagBackend::Sniff(file);
+	return backend;
+}
 
-			} else if (fs::is_directory(p)) {
-				Log << _T("Directory: ") << p.string<tstring>() << std::endl;
+void FileTagger::OnWalkDirectory(const fs::path &p)
+{
+	LogDebug << _T("Directory: ") << p.string<tstring>() << std::endl;
+}
 
-			} else {
-				Log << _T("Error reading: ") << p.string<tstring>() << std::endl;
-			}
+void FileTagger::OnReadDirectory(const fs::path &, unsigned long long us)
+{
+	_metrics.Time(RunMetrics::Traversal, us);
+}
+
+void FileTagger::StartWorkers()
+{
+	_work_queue.reopen();
+	while(_threads.size() < _threads_max)
+		_threads.push_back(new boost::thread(boost::bind(&FileTagger::_thread_func, this)));
+}
+
+void FileTagger::StopWorkers()
+{
+	//Workers finish the files already queued, then return
+	_work_queue.close();
+	for(threadlist::iterator it = _threads.begin(); it != _threads.end(); ++it) {
+		(*it)->join();
+		delete *it;
+	}
+	_threads.clear();
+}
+
+void FileTagger::StartSampler()
+{
+	if(_sampler)
+		return;
+	_sampler_stop = false;
+	_sampler = new boost::thread(boost::bind(&FileTagger::_sampler_func, this));
+}
+
+void FileTagger::StopSampler()
+{
+	if(!_sampler)
+		return;
+	{
+		boost::lock_guard<boost::mutex> lock(_sampler_mtx);
+		_sampler_stop = true;
+		_sampler_cv.notify_all();
+	}
+	_sampler->join();
+	delete _sampler;
+	_sampler = NULL;
+	//Final numbers of this run
+	_metrics.Sample(_work_queue.size());
+	WriteMetrics();
+}
+
+void FileTagger::_sampler_func()
+{
+	boost::system_time next_write = boost::get_system_time() + boost::posix_time::seconds(_metrics_interval);
+	boost::unique_lock<boost::mutex> lock(_sampler_mtx);
+	while(!_sampler_stop) {
+		_sampler_cv.timed_wait(lock, boost::posix_time::milliseconds(SAMPLE_INTERVAL_MS));
+		if(_sampler_stop)
+			break;
+		_metrics.Sample(_work_queue.size());
+		if(boost::get_system_time() >= next_write) {
+			WriteMetrics();
+			next_write = boost::get_system_time() + boost::posix_time::seconds(_metrics_interval);
 		}
-	} catch (const fs::filesystem_error& ex) {
-		Log << ex.what() << std::endl;
 	}
 }
 
-void FileTagger::NewThread()
+//Replaces the metrics file as a whole so a scraper never reads half of it
+void FileTagger::WriteMetrics() const
 {
-	if(_threads.size() < _threads_max) {
-		thread_info_type new_thread(NULL, time(NULL));
-		_threads.push_back(new_thread);
-		std::pair<boost::thread*, time_t> &thread_info = _threads.back();
-		thread_info.second = time(NULL);
+	if(_metrics_file.empty())
+		return;
+	fs::path tmp = _metrics_file;
+	tmp += ".tmp";
+	{
+		std::ofstream out(tmp.string().c_str(), std::ios::trunc);
+		_metrics.Write(out);
+		out.close();
+		if(!out) {
+			LogError << _T("Cannot write metrics ") << tmp.string<tstring>() << std::endl;
+			return;
+		}
+	}
+	boost::system::error_code ec;
+	fs::rename(tmp, _metrics_file, ec);
+	if(ec)
+		LogError << _T("Cannot write metrics ") << _metrics_file.string<tstring>() << _T(": ") << ec.message() << std::endl;
+}
 
-		thread_info.first = new boost::thread(boost::bind(&FileTagger::_thread_func, this, &thread_info.second));
+void FileTagger::TagFileOnThread(const fs::path &file, const TagBackend *backend)
+{
+	if(_reader && backend == TagBackend::Mpeg()) {
+		_reader->Submit(file);	//queued once its head is in memory
+		return;
 	}
+	file_task task;
+	task.file = file;
+	task.backend = backend;
+	task.prefetched = false;
+	_work_queue.push(task);	//blocks while the workers are behind
 }
-void FileTagger::TagFileOnThread(fs::path file)
+
+//On the reader's thread; an empty head leaves the file to the worker
+void FileTagger::OnHeadRead(const fs::path &file, HeadReader::head_ptr head)
 {
-	NewThread();
-	boost::lock_guard<boost::mutex> lock(_mtx);
-	_work_queue.push_back(file);
+	file_task task;
+	task.file = file;
+	task.backend = TagBackend::Mpeg();	//only MP3s are read ahead
+	task.head = head;
+	task.prefetched = !!head;
+	_work_queue.push(task);
 }
 
-void FileTagger::_thread_func(time_t *last_alive)
+//Marks the files it is given as prefetched, and collects those that were not
+struct FileTagger::prefetch_picker {
+	std::vector<fs::path> files;
+	void operator()(file_task &task)
+	{
+		if(!task.prefetched) {
+			task.prefetched = true;
+			files.push_back(task.file);
+		}
+	}
+};
+
+//Warms the page cache for the next files in the queue, each once,
+//so their reads are served from memory by the time a worker gets there
+void FileTagger::PrefetchQueued()
 {
-	while(!_done || !_work_queue.empty()) {
-		time(last_alive);
-		fs::path file;
-		{
-			boost::lock_guard<boost::mutex> lock(_mtx);
-			if(_work_queue.empty())
-				continue;
-			file = _work_queue.front();
-			_work_queue.pop_front();
+	prefetch_picker picker;
+	_work_queue.visit(_prefetch, picker);
+	for(size_t i = 0; i < picker.files.size(); ++i)
+		Id3v2Tag::Prefetch(picker.files[i]);
+}
+
+void FileTagger::_thread_func()
+{
+	file_task task;
+	PatternSet::Scratch scratch;
+	while(_work_queue.pop(task)) {
+		if(_prefetch)
+			PrefetchQueued();
+		boost::system_time deadline = _task_timeout ?
+				boost::get_system_time() + boost::posix_time::seconds(_task_timeout) :
+				boost::system_time(boost::posix_time::pos_infin);
+		_metrics.WorkerBusy();
+		bool written = false;
+		try {
+			stage_timer timer(_metrics, RunMetrics::File);
+			if(task.undo)
+				RevertFile(task);
+			else
+				written = TagFile(task, deadline, scratch);
+		} catch (const std::exception& ex) {
+			_metrics.Add(RunMetrics::Errors);
+			LogError << _T("Error: ") << ex.what() << _T("\n\n");
 		}
-		TagFile(file);
+		//Stated once the file is closed, after the last of the events it causes
+		handled_file handled;
+		if(written && _watcher && StatFile(task.file, handled.stat)) {
+			handled.at = boost::get_system_time();
+			boost::mutex::scoped_lock lock(_handled_mtx);
+			ForgetHandled(handled.at);
+			_handled[task.file] = handled;
+		}
+		_metrics.WorkerIdle();
+		task.head.reset();
+		_work_queue.task_done();
 	}
 }
-void FileTagger::TagFile(fs::path file) const
+
+//Cheapest checks first: the name alone, then the tags (without reading
+//audio properties), and only then writing; true if the file was written
+bool FileTagger::TagFile(const file_task &task, boost::system_time deadline, PatternSet::Scratch &scratch) const
 {
-	fs::path filec = fs::canonical(file).make_preferred().native();
+	_metrics.Add(RunMetrics::FilesSeen);
+	fs::path filec = fs::canonical(task.file).make_preferred().native();
 
 	Log << _T("File: ") << filec.string<tstring>() << std::endl;
 
-	TagLib::FileRef f(filec.string<tstring>().c_str());
+	Journal *journal = _safe ? NULL : _journal.get();
+	if(journal && journal->IsDone(filec)) {
+		_metrics.Add(RunMetrics::SkippedJournal);
+		Log << _T("Skipped: Done before the run was interrupted\n\n");
+		return false;
+	}
+	//Only final outcomes are recorded as finished: a file that could not be
+	//read, or was abandoned on a timeout, is tried again by a resumed run
+
+	//Stage 0: audio
+	//A copy of a file already seen in this run is reported and, if asked
+	//to, gets the tags decided for the original without matching its name
+	file_stat st;
+	bool stated = (_index || _duplicates) && StatFile(filec, st);
+	bool indexed = _index && stated;
+	boost::uint64_t content_hash = 0;
+	duplicate_claim claim;
+	bool propagated = false;
+	tag_values resolved;
+	if(_duplicates && stated) {
+		stage_timer hash_timer(_metrics, RunMetrics::Hash);
+		if(!(indexed && _index->ContentHash(filec, st, content_hash)) && !AudioHash(filec, content_hash))
+			content_hash = 0;
+		hash_timer.stop();
+		fs::path original;
+		if(!content_hash)
+			LogDebug << _T("No audio hash for this format") << std::endl;
+		else if(_duplicates->Claim(content_hash, filec, original))
+			claim.Hold(_duplicates.get(), content_hash);
+		else {
+			_metrics.Add(RunMetrics::Duplicates);
+			Log << _T("Duplicate of: ") << original.string<tstring>() << std::endl;
+			propagated = _dedup_tags && !_safe && _duplicates->WaitResolved(content_hash, resolved);
+			if(propagated)
+				_metrics.Add(RunMetrics::TagsPropagated);
+		}
+	}
+
+	//Stage 1: name, unless the tags come from the original
+	MatchResult fields;
+	tstring file_name;
+	if(!propagated && !MatchName(filec, scratch, file_name, fields)) {
+		if(content_hash && indexed && !_safe)
+			_index->Record(filec, st, _settings_hash, RunIndex::NameRejected, content_hash);
+		if(journal)
+			journal->Finished(filec);
+		return false;
+	}
+
+	//Skip files a previous run already handled with the same settings
+	if(indexed && _index->IsCurrent(filec, st, _settings_hash)) {
+		_metrics.Add(RunMetrics::SkippedIndex);
+		if(journal)
+			journal->Finished(filec);
+		Log << _T("Skipped: Unchanged since the last run\n\n");
+		return false;
+	}
+
+	//Stage 2: tags
+	//MP3s with a plain ID3v2 tag are read directly, everything else through
+	//TagLib's class for the format
+	Id3v2Tag direct;
+	TagLib::FileRef f;
+	unsigned long long length = 0;	//of the file a save may have to rewrite, at most
+	stage_timer open_timer(_metrics, RunMetrics::Open);
+	TagLib::Tag *tag = OpenTag(filec, task.backend, task.head.get(), direct, f, length);
+	open_timer.stop();
+	if(!tag) {
+		_metrics.Add(RunMetrics::OpenFailed);
+		Log << _T("Error: Cannot read tags\n\n");
+		return false;
+	}
 
-	if(!CheckEmptyFields(f)) {
+	if(!CheckEmptyFields(tag)) {
+		_metrics.Add(RunMetrics::RejectedNonEmpty);
+		if(indexed && !_safe)
+			_index->Record(filec, st, _settings_hash, RunIndex::TagRejected, content_hash);
+		if(journal)
+			journal->Finished(filec);
 		Log << "Rejected: Non-Empty field(s)\n\n";
-		return;
+		return false;
 	}
-	Pattern::position_map fields;
 
-	tstring file_name;
-	if(!ExtractRelevantFileName(filec, file_name)) {
-		Log << "Rejected: Filename path separator mismatch\n\n";
-		return;
+	//Stage 3: write
+	//Timeouts are cooperative: a file is never interrupted while it is being written
+	if(boost::get_system_time() > deadline) {
+		_metrics.Add(RunMetrics::TimedOut);
+		Log << _T("Abandoned: Timeout of ") << _task_timeout << _T(" s exceeded before writing\n\n");
+		return false;
 	}
-	Log << _T("RelevantFileName: ") << file_name << std::endl;
+	UndoLog *undo = _safe ? NULL : _undo.get();
+	tag_values before;
+	if(journal || undo)
+		before = tag_values(tag);
+	bool changed = propagated ? SetValues(tag, resolved, !_safe) : UpdateTags(tag, file_name, fields);
+	if(claim.held() && !_safe)
+		claim.Resolve(tag_values(tag));
+	if(!changed) {
+		_metrics.Add(RunMetrics::Unchanged);
+		_metrics.Add(RunMetrics::BytesAvoided, length);
+		if(indexed && !_safe)
+			_index->Record(filec, st, _settings_hash, RunIndex::Unchanged, content_hash);
+		if(journal)
+			journal->Finished(filec);
+		Log << _T("Unchanged: Tags already up to date\n\n");
+		return false;
+	}
+	if(!_safe) {
+		stage_timer timer(_metrics, RunMetrics::Save);
+		if(undo)
+			undo->Record(filec, before);
+		if(tag == &direct) {
+			direct.SetPadding(_padding);
+			if(journal) {
+				//The exact bytes of an in-place write, so it can be redone
+				Id3v2Tag::patch patch;
+				bool in_place = direct.Plan(patch);
+				direct.SetSafeRewrite(true);
+				journal->Begin(filec, before, tag_values(tag), in_place ? &patch : NULL);
+			}
+			if(!direct.save())
+				throw Exc("Cannot save tags");
+			_metrics.Add(direct.written() == Id3v2Tag::InPlace ? RunMetrics::WrittenInPlace : RunMetrics::WrittenRewrite);
+			_metrics.Add(RunMetrics::BytesWritten, direct.bytes_written());
+		} else {
+			tag_values after(tag);
+			f = TagLib::FileRef();
+			if(journal) {
+				journal->Begin(filec, before, after, NULL);
+				SaveCopy(filec, task.backend, after);
+			} else
+				SaveTagLib(filec, task.backend, after);
+			_metrics.Add(RunMetrics::WrittenTagLib);
+			_metrics.Add(RunMetrics::BytesWritten, length);
+		}
+	}
+	_metrics.Add(RunMetrics::Saved);
+	//Record the file as it is after the write
+	if(indexed && !_safe && StatFile(filec, st))
+		_index->Record(filec, st, _settings_hash, RunIndex::Tagged, content_hash);
+	if(journal)
+		journal->Finished(filec);
+	Log << "Done\n\n";
+	return !_safe;
+}
 
-	if(_pattern.match(file_name, fields))
+//Patterns are tried by priority; the name and its delimiter scan are
+//shared by consecutive patterns of the same group
+//A rejected name is counted under the reason of the highest priority pattern
+bool FileTagger::MatchName(const fs::path &file, PatternSet::Scratch &scratch, tstring &file_name, MatchResult &fields) const
+{
+	stage_timer match_timer(_metrics, RunMetrics::Match);
+	size_t scanned_group = (size_t)-1;
+	size_t matched = _patterns.size();
+	RunMetrics::Counter rejection = RunMetrics::COUNTER_COUNT;
+	for(size_t i = 0; i < _patterns.size() && matched == _patterns.size(); ++i)
 	{
-		UpdateTags(f, fields);
-		Log << "Done\n\n";
+		const Pattern &pattern = _patterns[i];
+		tstring which = _patterns.size() > 1 ? _T("Pattern ") + boost::lexical_cast<tstring>(i+1) + _T(": ") : tstring();
+		if(_patterns.group(i) != scanned_group) {
+			scanned_group = (size_t)-1;
+			if(!ExtractRelevantFileName(file, pattern, file_name)) {
+				Log << which << _T("Rejected: Filename path separator mismatch\n\n");
+				if(rejection == RunMetrics::COUNTER_COUNT)
+					rejection = RunMetrics::RejectedPath;
+				continue;
+			}
+			LogDebug << _T("RelevantFileName: ") << file_name << std::endl;
+			_patterns.Scan(file_name.data(), file_name.size(), scratch);
+			scanned_group = _patterns.group(i);
+		}
+
+		if(_patterns.Match(i, file_name.data(), file_name.size(), scratch, fields))
+			matched = i;
+		else {
+			RunMetrics::Counter reason;
+			if(fields.status == MatchNoDelimiter) {
+				Log << which << _T("Rejected: Delimiter `") << pattern.delimiter(fields.failed_delimiter) << _T("` not found\n\n");
+				reason = RunMetrics::RejectedDelimiter;
+			} else if(fields.status == MatchNoExpression) {
+				Log << which << _T("Rejected: Name does not match the expression\n\n");
+				reason = RunMetrics::RejectedExpression;
+			} else {
+				Log << which << _T("Rejected: Field count mismatch\n\n");
+				reason = RunMetrics::RejectedFieldCount;
+			}
+			if(rejection == RunMetrics::COUNTER_COUNT)
+				rejection = reason;
+		}
+	}
+	match_timer.stop();
+	if(matched == _patterns.size()) {
+		_metrics.Add(rejection);
+		return false;
+	}
+	if(_patterns.size() > 1)
+		Log << _T("Matched pattern ") << matched+1 << std::endl;
+	return true;
+}
+
+//Reads the tags directly if the file has a plain ID3v2 tag, and through
+//TagLib's class for the format, read-only, otherwise; NULL if neither can
+TagLib::Tag *FileTagger::OpenTag(const fs::path &file, const TagBackend *backend, Id3v2Tag::file_head *head,
+		Id3v2Tag &direct, TagLib::FileRef &f, unsigned long long &length) const
+{
+	bool direct_read = false;
+	if(_direct_id3 && backend->direct_id3()) {
+		if(head)
+			direct_read = direct.Read(file, *head);
+		else if(_mapped_reads)
+			direct_read = direct.Map(file);
+		else
+			direct_read = direct.Read(file);
+	}
+	if(direct_read) {
+		_metrics.Add(RunMetrics::DirectRead);
+		length = direct.file_size();
+		return &direct;
+	}
+	f = TagLib::FileRef(backend->Open(file, true));
+	if(f.isNull() || !f.tag())
+		return NULL;
+	length = f.file()->length();
+	return f.tag();
+}
+
+//Puts back the values an undo log entry holds, unless the file has them already
+void FileTagger::RevertFile(const file_task &task) const
+{
+	_metrics.Add(RunMetrics::FilesSeen);
+	fs::path file;
+	tag_values logged;
+	if(!task.undo->Entry(task.entry, file, logged))
+		throw Exc("Undo log entry is not valid");
+
+	Log << _T("Revert: ") << file.string<tstring>() << std::endl;
+
+	Id3v2Tag direct;
+	TagLib::FileRef f;
+	unsigned long long length = 0;
+	stage_timer open_timer(_metrics, RunMetrics::Open);
+	const TagBackend *backend = BackendFor(file, true);
+	TagLib::Tag *tag = backend ? OpenTag(file, backend, NULL, direct, f, length) : NULL;
+	open_timer.stop();
+	if(!tag) {
+		_metrics.Add(RunMetrics::OpenFailed);
+		Log << _T("Error: Cannot read tags\n\n");
+		return;
+	}
+	if(tag_values(tag) == logged) {
+		_metrics.Add(RunMetrics::Unchanged);
+		_metrics.Add(RunMetrics::BytesAvoided, length);
+		Log << _T("Unchanged: Tags already as logged\n\n");
 		return;
 	}
+	if(!_safe) {
+		stage_timer timer(_metrics, RunMetrics::Save);
+		logged.ApplyTo(tag);
+		if(tag == &direct) {
+			direct.SetPadding(_padding);
+			if(!direct.save())
+				throw Exc("Cannot save tags");
+			_metrics.Add(direct.written() == Id3v2Tag::InPlace ? RunMetrics::WrittenInPlace : RunMetrics::WrittenRewrite);
+			_metrics.Add(RunMetrics::BytesWritten, direct.bytes_written());
+		} else {
+			f = TagLib::FileRef();
+			SaveTagLib(file, backend, logged);
+			_metrics.Add(RunMetrics::WrittenTagLib);
+			_metrics.Add(RunMetrics::BytesWritten, length);
+		}
+	}
+	_metrics.Add(RunMetrics::Saved);
+	Log << _T("Reverted\n\n");
+}
 
+//The tags were read read-only; the file is opened again to write them
+void FileTagger::SaveTagLib(const fs::path &file, const TagBackend *backend, const tag_values &values) const
+{
+	TagLib::FileRef f(backend->Open(file, false));
+	if(f.isNull() || !f.tag())
+		throw Exc("Cannot save tags");
+	values.ApplyTo(f.tag());
+	if(!f.save())
+		throw Exc("Cannot save tags");
 }
 
-void FileTagger::UpdateTags(TagLib::FileRef &file, Pattern::position_map &fieldmap) const
+//TagLib writes in place, and may move the audio; with a journal it saves a
+//copy that replaces the file once it is on disk
+void FileTagger::SaveCopy(const fs::path &file, const TagBackend *backend, const tag_values &values) const
 {
-	for (Pattern::position_map::iterator it = fieldmap.begin();	it!=fieldmap.end(); ++it) {
-		Field &field = it->second;
+	fs::path tmp = TempPathFor(file);
+	fs::copy_file(file, tmp, fs::copy_option::overwrite_if_exists);
+	bool ok;
+	{
+		TagLib::FileRef copy(backend->Open(tmp, false));	//the copy's name has no extension TagLib knows
+		ok = !copy.isNull() && copy.tag();
+		if(ok) {
+			values.ApplyTo(copy.tag());
+			ok = copy.save();
+		}
+	}
+	if(!ok || !SyncFile(tmp)) {
+		boost::system::error_code ec;
+		fs::remove(tmp, ec);
+		throw Exc("Cannot save tags");
+	}
+	fs::rename(tmp, file);
+}
+
+//Set a tag only if it does not already hold the value; true if it differed
+static bool SetIfDifferent(TagLib::Tag *tag, TagLib::String (TagLib::Tag::*get)() const,
+		void (TagLib::Tag::*set)(const TagLib::String &), const TagLib::String &value, bool write)
+{
+	if((tag->*get)() == value)
+		return false;
+	if(write)
+		(tag->*set)(value);
+	return true;
+}
+
+static bool SetIfDifferent(TagLib::Tag *tag, TagLib::uint (TagLib::Tag::*get)() const,
+		void (TagLib::Tag::*set)(TagLib::uint), TagLib::uint value, bool write)
+{
+	if((tag->*get)() == value)
+		return false;
+	if(write)
+		(tag->*set)(value);
+	return true;
+}
+
+//Looks up the artist with the title or album the name gave
+bool FileTagger::LookupCatalog(const tstring &file_name, const MatchResult &fields, catalog_entry &entry) const
+{
+	std::string names[_Unknown];
+	for (size_t i = 0; i < fields.count; ++i) {
+		const FieldSpan &span = fields.fields[i];
+		if(span.type == Artist || span.type == Album || span.type == Title)
+			names[span.type] = ToUtf8(file_name.data() + span.begin, span.size());
+	}
+	if(names[Artist].empty() || !_catalog->Find(names[Artist], names[Album], names[Title], entry))
+		return false;
+	LogDebug << _T("Catalog: found `") << entry.artist.to8Bit(true).c_str() << _T("`") << std::endl;
+	return true;
+}
+
+//Returns false if every field already had the extracted value; the caller saves
+//With a catalog, names it knows are written as it spells them, and year,
+//genre and track the name did not give are taken from it
+bool FileTagger::UpdateTags(TagLib::Tag *tag, const tstring &file_name, const MatchResult &fields) const
+{
+	bool write = !_safe;
+	bool changed = false;
+	catalog_entry entry;
+	bool cataloged = _catalog && LookupCatalog(file_name, fields, entry);
+	bool extracted[_Unknown] = {false};
+	for (size_t i = 0; i < fields.count; ++i) {
+		const FieldSpan &span = fields.fields[i];
+		Field field(file_name.substr(span.begin, span.size()), span.type);
+		if(field._type < _Unknown)
+			extracted[field._type] = true;
 
 		switch(field._type)
 		{
 		case Artist:
-			if(!_safe) file.tag()->setArtist(field._content);
-			Log << _T("Artist = `") << field._content << _T("`") << std::endl;
+			changed |= SetIfDifferent(tag, &TagLib::Tag::artist, &TagLib::Tag::setArtist,
+					cataloged ? entry.artist : ToTagString(field._content), write);
+			LogDebug << _T("Artist = `") << field._content << _T("`") << std::endl;
 			break;
 		case Title:
-			if(!_safe) file.tag()->setTitle(field._content);
-			Log << _T("Title = `") << field._content << _T("`") << std::endl;
+			changed |= SetIfDifferent(tag, &TagLib::Tag::title, &TagLib::Tag::setTitle,
+					cataloged && !entry.title.isEmpty() ? entry.title : ToTagString(field._content), write);
+			LogDebug << _T("Title = `") << field._content << _T("`") << std::endl;
 			break;
 		case Album:
-			if(!_safe) file.tag()->setAlbum(field._content);
-			Log << _T("Album = `") << field._content << _T("`") << std::endl;
+			changed |= SetIfDifferent(tag, &TagLib::Tag::album, &TagLib::Tag::setAlbum,
+					cataloged && !entry.album.isEmpty() ? entry.album : ToTagString(field._content), write);
+			LogDebug << _T("Album = `") << field._content << _T("`") << std::endl;
 			break;
 		case Genre:
-			if(!_safe) file.tag()->setGenre(field._content);
-			Log << _T("Genre = `") << field._content << _T("`") << std::endl;
+			changed |= SetIfDifferent(tag, &TagLib::Tag::genre, &TagLib::Tag::setGenre, ToTagString(field._content), write);
+			LogDebug << _T("Genre = `") << field._content << _T("`") << std::endl;
 			break;
 		case Comment:
-			if(!_safe) file.tag()->setComment(field._content);
-			Log << _T("Comment = `") << field._content << _T("`") << std::endl;
+			changed |= SetIfDifferent(tag, &TagLib::Tag::comment, &TagLib::Tag::setComment, ToTagString(field._content), write);
+			LogDebug << _T("Comment = `") << field._content << _T("`") << std::endl;
 			break;
 		case TrackNo:
-			if(!_safe) file.tag()->setTrack(atoi(field.ToCharArr()));
-			Log << _T("Track# = `") << field._content << _T("`") << std::endl;
+			changed |= SetIfDifferent(tag, &TagLib::Tag::track, &TagLib::Tag::setTrack, field.ToNumber(), write);
+			LogDebug << _T("Track# = `") << field._content << _T("`") << std::endl;
 			break;
 		case Year:
-			if(!_safe) file.tag()->setYear(atoi(field.ToCharArr()));
-			Log << _T("Year = `") << field._content << _T("`") << std::endl;
+			changed |= SetIfDifferent(tag, &TagLib::Tag::year, &TagLib::Tag::setYear, field.ToNumber(), write);
+			LogDebug << _T("Year = `") << field._content << _T("`") << std::endl;
 			break;
 
 		default:
 			break;
 		}
 	}
-	if(!_safe) file.save();
+	if(cataloged) {
+		if(!extracted[Year] && entry.year)
+			changed |= SetIfDifferent(tag, &TagLib::Tag::year, &TagLib::Tag::setYear, entry.year, write);
+		if(!extracted[Genre] && !entry.genre.isEmpty())
+			changed |= SetIfDifferent(tag, &TagLib::Tag::genre, &TagLib::Tag::setGenre, entry.genre, write);
+		if(!extracted[TrackNo] && entry.track)
+			changed |= SetIfDifferent(tag, &TagLib::Tag::track, &TagLib::Tag::setTrack, entry.track, write);
+	}
+	return changed;
 }
 
-bool FileTagger::CheckEmptyFields(TagLib::FileRef &file) const
+bool FileTagger::CheckEmptyFields(const TagLib::Tag *tag) const
 {
 	for (std::vector<tstring>::const_iterator it = _empty_fields.begin();
 			it!=_empty_fields.end(); ++it) {
 		const tstring &field = *it;
-		if(		(field == _T("<Artist>") && !file.tag()->artist().isEmpty())
-			|| 	(field == _T("<Title>") && !file.tag()->title().isEmpty())
-			|| 	(field == _T("<Album>") && !file.tag()->album().isEmpty())
-			|| 	(field == _T("<Genre>") && !file.tag()->genre().isEmpty())
-			|| 	(field == _T("<Comment>") && !file.tag()->comment().isEmpty())
-			|| 	(field == _T("<Year>") && !file.tag()->year())
-			|| 	(field == _T("<Track#>") && !file.tag()->track()) )
+		if(		(field == _T("<Artist>") && !tag->artist().isEmpty())
+			|| 	(field == _T("<Title>") && !tag->title().isEmpty())
+			|| 	(field == _T("<Album>") && !tag->album().isEmpty())
+			|| 	(field == _T("<Genre>") && !tag->genre().isEmpty())
+			|| 	(field == _T("<Comment>") && !tag->comment().isEmpty())
+			|| 	(field == _T("<Year>") && !tag->year())
+			|| 	(field == _T("<Track#>") && !tag->track()) )
 			return false;
 	}
 	return true;
 }
 
 
-bool FileTagger::ExtractRelevantFileName(fs::path file_path, tstring &out) const
+bool FileTagger::ExtractRelevantFileName(fs::path file_path, const Pattern &pattern, tstring &out) const
 {
 	out = _T("");
-	size_t nSeparators = _pattern.get_separator_count();
+	size_t nSeparators = pattern.get_separator_count();
 	if(nSeparators)
 	{
-		size_t nTokens = _pattern.begins_with_separator() ? nSeparators-1 : nSeparators;
+		size_t nTokens = pattern.begins_with_separator() ? nSeparators-1 : nSeparators;
 		//Explode path
 		tstring parentpath = file_path.parent_path().string<tstring>();
 		std::vector<tstring> tokens;
@@ -576,7 +1058,7 @@ bool FileTagger::ExtractRelevantFileName(fs::path file_path, tstring &out) const
 		boost::filesystem::path slash("/");
 		fs::path::string_type platform_slash = slash.make_preferred().native();
 
-		if(_pattern.begins_with_separator())
+		if(pattern.begins_with_separator())
 			out.append(platform_slash);
 		while(!tokens.empty() && nTokens)
 		{
@@ -12,112 +12,157 @@
 
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
-#include <list>
 #include <map>
 #include <vector>
-#include <time.h>
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
 #include "common.h"
+#include "Catalog.h"
+#include "PatternSet.h"
+#include "DirectoryWatcher.h"
+#include "DuplicateTable.h"
+#include "HeadReader.h"
+#include "Id3v2.h"
+#include "Journal.h"
+#include "Metrics.h"
+#include "RunIndex.h"
+#include "TagBackend.h"
+#include "UndoLog.h"
 
 
-//////////////////////////////////////////////////////////////////////////////////
-
-enum FieldType {Title = 0, Artist, Album, TrackNo, Genre,
-				Year, Comment, Ignore, Delimiter, _Unknown};
-
-tstring FieldTypeToString(FieldType type);
-
-//////////////////////////////////////////////////////////////////////////////////
-
-class Field {
-private:
-	Field(): _type(_Unknown) {}
-	static std::string content_narrow;
-	const char* ToCharArr(std::string &src);
-	const char* ToCharArr(std::wstring &src);
-public:
-	Field(tstring content, FieldType type);
-	virtual ~Field();
-public:
-	tstring _content;
-	FieldType _type;
-	size_t size() { return _content.size(); }
-
-	const char* ToCharArr();
-};
-
-//////////////////////////////////////////////////////////////////////////////////
-
-class Pattern {
-public:
-	typedef std::map<size_t, Field> position_map;
-
-	Pattern(tstring format, bool trim);
-	~Pattern();
-protected:
-	position_map _structure;
-	position_map _delimiters_generic;
-
-	tstring _pattern;
-	bool _valid;
-	bool _trim;
-	tstring _trim_chars;
-
-	size_t _nNamedFields;
-	size_t _nDelFields;
-	size_t _nPathSeparators;
-
-	bool parse();
-	bool parse_helper(size_t pos, size_t size, size_t prev_pos, size_t prev_size);
-	int find_in_pattern(Field needle);
-
-public:
-	bool match(tstring &file_stem, position_map &out) const;
-	void print() const;
-	static int find_insert_field(Field needle, tstring &haystack, position_map &out);
-
-	size_t get_separator_count() { return _nPathSeparators; }
-	bool begins_with_separator();
-	void SetTrimChars(tstring chars) { _trim_chars = chars; }
-};
-
 //////////////////////////////////////////////////////////////////////////////////
 
 class FileTagger {
 public:
-	FileTagger(Pattern &p, bool replace_non_empty=true);
+	FileTagger(PatternSet &p, bool replace_non_empty=true);
 	virtual ~FileTagger();
 
 	void SetEmptyFieldConstraint(std::vector<tstring> &empty_fields);
 	void SetSafeMode(bool safe_mode);
-	void SetThreadCount(unsigned int count) { _threads_max = count;}
+	void SetThreadCount(unsigned int count);
+	void SetTaskTimeout(unsigned int seconds) { _task_timeout = seconds; }
+	void SetDirectId3(bool direct) { _direct_id3 = direct; }	//false: always go through TagLib
+	void SetPadding(size_t bytes) { _padding = bytes; }		//reserved when a tag has to grow
+	void SetAsyncReads(bool async) { _async_reads = async; }	//read file heads through io_uring
+	void SetMappedReads(bool mapped) { _mapped_reads = mapped; }	//read ID3v2 tags through mmap
+	void SetPrefetch(unsigned int files) { _prefetch = files; }	//queued files to read ahead, 0 = none
+	void SetSniff(bool sniff) { _sniff = sniff; }	//look into files of unknown extensions for their format
+	//Find files with the same audio; with propagate, copies get their original's tags
+	void SetDuplicates(bool detect, bool propagate);
+	void SetIndexFile(tstring path);
+	//Complete the fields of a name from the catalog there
+	bool SetCatalog(tstring path);
+	//Journal updates there and resume from it after a crash
+	void SetJournalFile(tstring path);
+	//Log the old values of every file written there, for Revert()
+	void SetUndoLog(tstring path);
+	void SetMetricsFile(tstring path, unsigned int interval_seconds);
 	void Tag(tstring path, bool recursive);
+	//Tags every path read from in, as they arrive, until the stream ends
+	void TagList(std::basic_istream<char_type> &in, char_type delimiter, bool recursive);
+	//Tags files as they are written or moved below path, until StopWatching()
+	bool Watch(tstring path, bool recursive, unsigned int debounce_ms);
+	//Puts back the values an undo log holds, on the worker threads
+	bool Revert(tstring log);
+	void StopWatching();			//async-signal-safe
+	void SaveIndex();
+	void PrintSummary() const;
+	const RunMetrics &Metrics() const { return _metrics; }
 
 protected:
-	void UpdateTags(TagLib::FileRef &file, Pattern::position_map &fieldmap) const;
-	bool CheckEmptyFields(TagLib::FileRef &file) const;
+	void BeginRun();
+	void EndRun();
+	void TagPath(const fs::path &path, bool recursive);
+	bool MatchName(const fs::path &file, PatternSet::Scratch &scratch, tstring &file_name, MatchResult &fields) const;
+	bool UpdateTags(TagLib::Tag *tag, const tstring &file_name, const MatchResult &fields) const;
+	bool LookupCatalog(const tstring &file_name, const MatchResult &fields, catalog_entry &entry) const;
+	bool CheckEmptyFields(const TagLib::Tag *tag) const;
+	void SaveTagLib(const fs::path &file, const TagBackend *backend, const tag_values &values) const;
+	void SaveCopy(const fs::path &file, const TagBackend *backend, const tag_values &values) const;
 	void TagDirectory(fs::path dir);
 	void TagDirectoryRecursive(fs::path dir);
-	void TagFile(fs::path file) const;
-	void TagFileOnThread(fs::path file);
-	void _thread_func(time_t *last_alive);
-	void NewThread();
-	bool ExtractRelevantFileName(fs::path file_path, tstring &out) const;
+	void OnWalkFile(const fs::path &p);
+	void OnWalkDirectory(const fs::path &p);
+	void OnReadDirectory(const fs::path &p, unsigned long long us);
+	void OnWatchFile(const fs::path &p);
+	void ForgetHandled(boost::system_time now);
+	void OnWatchDirectory(const fs::path &p, bool recursive);
+	//A file for the workers, with its format and its head if it was read
+	//ahead, or an entry of the undo log to revert
+	struct file_task {
+		fs::path file;
+		const TagBackend *backend;
+		HeadReader::head_ptr head;
+		bool prefetched;			//page cache warmed, or head already read
+		const UndoLog *undo;
+		size_t entry;
+
+		file_task() : backend(NULL), prefetched(false), undo(NULL), entry(0) {}
+	};
+	struct prefetch_picker;
+
+	//A file a worker wrote while watching, as it left it
+	struct handled_file {
+		file_stat stat;
+		boost::system_time at;
+	};
+
+	bool TagFile(const file_task &task, boost::system_time deadline, PatternSet::Scratch &scratch) const;
+	void RevertFile(const file_task &task) const;
+	TagLib::Tag *OpenTag(const fs::path &file, const TagBackend *backend, Id3v2Tag::file_head *head,
+			Id3v2Tag &direct, TagLib::FileRef &f, unsigned long long &length) const;
+	const TagBackend *BackendFor(const fs::path &file, bool named) const;
+	void TagFileOnThread(const fs::path &file, const TagBackend *backend);
+	void OnHeadRead(const fs::path &file, HeadReader::head_ptr head);
+	void PrefetchQueued();
+	void _thread_func();
+	void StartWorkers();
+	void StopWorkers();
+	void StartSampler();
+	void StopSampler();
+	void _sampler_func();
+	void WriteMetrics() const;
+	bool ExtractRelevantFileName(fs::path file_path, const Pattern &pattern, tstring &out) const;
+	unsigned long long SettingsHash() const;
 
 protected:
-	Pattern &_pattern;
+	PatternSet &_patterns;
 	std::vector<tstring> _empty_fields;
 	bool _safe;						//safe mode: don't write changes
 	bool _replace;					//replace if tag exists?
+	bool _direct_id3;				//read and write plain ID3v2 tags without TagLib
+	bool _sniff;					//files of unknown extensions are looked into
+	size_t _padding;
+	bool _async_reads;				//heads read ahead by _reader, if io_uring works
+	boost::scoped_ptr<HeadReader> _reader;	//during a run
+	bool _mapped_reads;
+	unsigned int _prefetch;
+	boost::scoped_ptr<RunIndex> _index;	//results of previous runs, optional
+	boost::scoped_ptr<Journal> _journal;	//optional, not used in safe mode
+	boost::scoped_ptr<UndoLog> _undo;	//optional, not used in safe mode
+	boost::scoped_ptr<DuplicateTable> _duplicates;	//audio hashes of this run, optional
+	boost::scoped_ptr<Catalog> _catalog;	//optional
+	bool _dedup_tags;				//copies are tagged like their original
+	unsigned long long _settings_hash;	//identifies patterns and options in the index
 	//Threads
-	typedef std::pair<boost::thread*, time_t>	thread_info_type;
-	typedef std::list<thread_info_type> threadlist;
-	typedef std::list<fs::path> worklist;
+	typedef std::vector<boost::thread*> threadlist;
 	//
 	unsigned int _threads_max;		//# of workers
+	unsigned int _task_timeout;		//seconds a file may take before its write is abandoned, 0 = no limit
 	threadlist _threads;
-	worklist _work_queue;
-	boost::mutex _mtx;
-	bool _done;
+	work_queue<file_task> _work_queue;
+	DirectoryWatcher *volatile _watcher;	//while Watch() runs
+	std::map<fs::path, handled_file> _handled;	//written while watching, until their event
+	boost::posix_time::time_duration _handled_ttl;	//how long an event is waited for
+	boost::mutex _handled_mtx;
+	//Metrics
+	mutable RunMetrics _metrics;
+	fs::path _metrics_file;			//written periodically if set
+	unsigned int _metrics_interval;	//seconds
+	boost::thread *_sampler;
+	boost::mutex _sampler_mtx;
+	boost::condition_variable _sampler_cv;
+	bool _sampler_stop;
 };
 
 #endif /* FILETAG_H_ */
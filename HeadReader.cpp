@@ -0,0 +1,404 @@
+/*
+ * HeadReader.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "HeadReader.h"
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#ifdef __linux__
+	#include <cerrno>
+	#include <cstring>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+	#include <linux/io_uring.h>
+#endif
+
+#ifdef __linux__
+
+//Operations of one file; the low bits of user_data
+enum {OpOpen = 0, OpStat, OpHead, OpTail, OP_BITS = 2};
+
+struct HeadReader::request {
+	fs::path file;
+	head_ptr data;
+	struct statx stx;
+	int fd;
+	unsigned int waiting;			//operations in flight
+	bool failed;
+};
+
+//The rings shared with the kernel, without liburing
+struct HeadReader::ring {
+	int fd;
+	unsigned int entries;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_len, cq_len, sqes_len;
+
+	ring() : fd(-1), sqes(NULL), sq_map(MAP_FAILED), cq_map(MAP_FAILED), sq_len(0), cq_len(0), sqes_len(0) {}
+
+	~ring()
+	{
+		if(sqes)
+			munmap(sqes, sqes_len);
+		if(cq_map != MAP_FAILED && cq_map != sq_map)
+			munmap(cq_map, cq_len);
+		if(sq_map != MAP_FAILED)
+			munmap(sq_map, sq_len);
+		if(fd >= 0)
+			::close(fd);
+	}
+
+	bool setup(unsigned int n)
+	{
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		fd = (int)syscall(__NR_io_uring_setup, n, &p);
+		if(fd < 0)
+			return false;
+		entries = p.sq_entries;
+		sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		if(p.features & IORING_FEAT_SINGLE_MMAP)
+			sq_len = cq_len = std::max(sq_len, cq_len);
+		sq_map = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if(sq_map == MAP_FAILED)
+			return false;
+		cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq_map :
+				mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(cq_map == MAP_FAILED)
+			return false;
+		sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+		void *s = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if(s == MAP_FAILED)
+			return false;
+		sqes = static_cast<struct io_uring_sqe*>(s);
+
+		char *sq = static_cast<char*>(sq_map), *cq = static_cast<char*>(cq_map);
+		sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+		sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+		cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+		return true;
+	}
+
+	bool supports(const int *ops, size_t count) const
+	{
+		const unsigned int OPS = 256;
+		std::vector<char> buffer(sizeof(struct io_uring_probe) + OPS * sizeof(struct io_uring_probe_op));
+		struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe*>(&buffer[0]);
+		if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, OPS) < 0)
+			return false;
+		for(size_t i = 0; i < count; ++i)
+			if(ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+				return false;
+		return true;
+	}
+
+	//Only the reader's thread writes the tail; the kernel moves the head.
+	//Never full: there are twice as many entries as files in flight
+	struct io_uring_sqe *next(unsigned long long user_data, int opcode)
+	{
+		unsigned tail = *sq_tail;
+		if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries)
+			return NULL;
+		unsigned index = tail & *sq_mask;
+		struct io_uring_sqe *sqe = &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = (__u8)opcode;
+		sqe->user_data = user_data;
+		sq_array[index] = index;
+		return sqe;
+	}
+
+	void publish()
+	{
+		__atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+	}
+
+	int enter(unsigned int to_submit, unsigned int min_complete)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+				min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	}
+};
+
+HeadReader::HeadReader(head_callback on_read, unsigned int depth)
+: _on_read(on_read)
+, _depth(depth ? depth : 1)
+, _ring(NULL)
+, _thread(NULL)
+, _to_submit(0)
+, _pending(0)
+, _stop(false)
+{
+}
+
+HeadReader::~HeadReader()
+{
+	Stop();
+	for(size_t i = 0; i < _requests.size(); ++i)
+		delete _requests[i];
+	delete _ring;
+}
+
+bool HeadReader::Start()
+{
+	static const int OPS[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ};
+	errno = 0;
+	_ring = new ring;
+	//At most two operations per file are in flight
+	if(!_ring->setup(_depth * 2) || !_ring->supports(OPS, sizeof(OPS) / sizeof(OPS[0]))) {
+		Log << _T("io_uring is not available (") << strerror(errno ? errno : ENOSYS) << _T("), reading on the worker threads") << std::endl;
+		delete _ring;
+		_ring = NULL;
+		return false;
+	}
+	for(size_t i = 0; i < _depth; ++i) {
+		_requests.push_back(new request);
+		_requests.back()->fd = -1;
+		_free.push_back(_depth - 1 - i);
+	}
+	_thread = new boost::thread(boost::bind(&HeadReader::_thread_func, this));
+	return true;
+}
+
+void HeadReader::Submit(const fs::path &file)
+{
+	boost::unique_lock<boost::mutex> lock(_mtx);
+	while(!_stop && _queued.size() >= _depth)
+		_cv.wait(lock);
+	_queued.push_back(file);
+	++_pending;
+	_cv.notify_all();
+}
+
+void HeadReader::Drain()
+{
+	boost::unique_lock<boost::mutex> lock(_mtx);
+	while(_pending)
+		_cv.wait(lock);
+}
+
+void HeadReader::Stop()
+{
+	if(!_thread)
+		return;
+	{
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		_stop = true;
+		_cv.notify_all();
+	}
+	_thread->join();
+	delete _thread;
+	_thread = NULL;
+}
+
+//Queued files go into free slots: their open and statx are prepared together
+bool HeadReader::Fill()
+{
+	boost::unique_lock<boost::mutex> lock(_mtx);
+	while(_queued.empty() && _free.size() == _depth && !_stop)
+		_cv.wait(lock);
+	if(_queued.empty() && _free.size() == _depth)
+		return false;			//stopped, nothing left
+	bool took = false;
+	while(!_queued.empty() && !_free.empty()) {
+		size_t slot = _free.back();
+		_free.pop_back();
+		request &r = *_requests[slot];
+		r.file = _queued.front();
+		_queued.pop_front();
+		r.data.reset(new Id3v2Tag::file_head);
+		r.fd = -1;
+		r.failed = false;
+		r.waiting = 2;
+
+		unsigned long long id = (unsigned long long)slot << OP_BITS;
+		struct io_uring_sqe *sqe = _ring->next(id | OpOpen, IORING_OP_OPENAT);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long long)(uintptr_t)r.file.c_str();
+		sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		_ring->publish();
+		sqe = _ring->next(id | OpStat, IORING_OP_STATX);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long long)(uintptr_t)r.file.c_str();
+		sqe->len = STATX_SIZE;
+		sqe->off = (unsigned long long)(uintptr_t)&r.stx;
+		_ring->publish();
+		_to_submit += 2;
+		took = true;
+	}
+	if(took)
+		_cv.notify_all();		//room for Submit()
+	return true;
+}
+
+void HeadReader::_thread_func()
+{
+	while(Fill()) {
+		if(_free.size() == _depth)
+			continue;
+		//Submits everything prepared and waits for at least one completion
+		int n = _ring->enter(_to_submit, 1);
+		if(n < 0) {
+			if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			LogError << _T("io_uring: ") << strerror(errno) << std::endl;
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+			continue;
+		}
+		_to_submit -= std::min<unsigned int>(n, _to_submit);
+
+		unsigned head = *_ring->cq_head;
+		unsigned tail = __atomic_load_n(_ring->cq_tail, __ATOMIC_ACQUIRE);
+		while(head != tail) {
+			const struct io_uring_cqe &cqe = _ring->cqes[head & *_ring->cq_mask];
+			unsigned long long user_data = cqe.user_data;
+			int result = cqe.res;
+			__atomic_store_n(_ring->cq_head, ++head, __ATOMIC_RELEASE);
+			Complete(user_data, result);
+		}
+	}
+}
+
+void HeadReader::Complete(unsigned long long user_data, int result)
+{
+	size_t slot = (size_t)(user_data >> OP_BITS);
+	int op = (int)(user_data & ((1 << OP_BITS) - 1));
+	request &r = *_requests[slot];
+	Id3v2Tag::file_head &data = *r.data;
+	switch(op) {
+	case OpOpen:
+		if(result >= 0)
+			r.fd = result;
+		else
+			r.failed = true;
+		break;
+	case OpStat:
+		r.failed |= result < 0;
+		break;
+	case OpHead:
+		r.failed |= result != (int)data.head.size();	//short: the file changed meanwhile
+		break;
+	case OpTail:
+		r.failed |= result != (int)data.tail.size();
+		break;
+	}
+	if(--r.waiting)
+		return;
+	if(op == OpHead || op == OpTail || r.failed) {
+		Finish(slot, !r.failed);
+		return;
+	}
+
+	//Opened: read the head, and the tail unless the head is the whole file
+	data.size = r.stx.stx_size;
+	data.head.resize((size_t)std::min<unsigned long long>(data.size, Id3v2Tag::HEAD_SIZE));
+	if(data.head.empty()) {
+		Finish(slot, false);
+		return;
+	}
+	unsigned long long id = (unsigned long long)slot << OP_BITS;
+	struct io_uring_sqe *sqe = _ring->next(id | OpHead, IORING_OP_READ);
+	sqe->fd = r.fd;
+	sqe->addr = (unsigned long long)(uintptr_t)&data.head[0];
+	sqe->len = (unsigned)data.head.size();
+	sqe->off = 0;
+	_ring->publish();
+	++_to_submit;
+	++r.waiting;
+	if(data.size > data.head.size()) {
+		data.tail.resize((size_t)std::min<unsigned long long>(data.size, Id3v2Tag::TAIL_SIZE));
+		sqe = _ring->next(id | OpTail, IORING_OP_READ);
+		sqe->fd = r.fd;
+		sqe->addr = (unsigned long long)(uintptr_t)&data.tail[0];
+		sqe->len = (unsigned)data.tail.size();
+		sqe->off = data.size - data.tail.size();
+		_ring->publish();
+		++_to_submit;
+		++r.waiting;
+	}
+}
+
+void HeadReader::Finish(size_t slot, bool ok)
+{
+	request &r = *_requests[slot];
+	if(r.fd >= 0) {
+		::close(r.fd);
+		r.fd = -1;
+	}
+	head_ptr data;
+	if(ok) {
+		data.swap(r.data);
+		if(data->tail.empty()) {
+			size_t n = (size_t)std::min<unsigned long long>(data->size, Id3v2Tag::TAIL_SIZE);
+			data->tail.assign(data->head, data->head.size() - n, n);
+		}
+	}
+	r.data.reset();
+	fs::path file;
+	file.swap(r.file);
+	_free.push_back(slot);
+	_on_read(file, data);
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	--_pending;
+	_cv.notify_all();
+}
+
+#else
+
+struct HeadReader::request {
+};
+
+struct HeadReader::ring {
+};
+
+HeadReader::HeadReader(head_callback on_read, unsigned int depth)
+: _on_read(on_read)
+, _depth(depth)
+, _ring(NULL)
+, _thread(NULL)
+, _to_submit(0)
+, _pending(0)
+, _stop(false)
+{
+}
+
+HeadReader::~HeadReader()
+{
+}
+
+bool HeadReader::Start()
+{
+	Log << _T("io_uring is not available on this platform, reading on the worker threads") << std::endl;
+	return false;
+}
+
+void HeadReader::Submit(const fs::path &file)
+{
+	_on_read(file, head_ptr());
+}
+
+void HeadReader::Drain()
+{
+}
+
+void HeadReader::Stop()
+{
+}
+
+#endif
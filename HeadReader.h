@@ -0,0 +1,72 @@
+/*
+ * HeadReader.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef HEADREADER_H_
+#define HEADREADER_H_
+
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include "common.h"
+#include "Id3v2.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Reads the head and tail of many files at once through io_uring (Linux 5.6+).
+//
+//One thread keeps up to depth files in flight: the open and the statx of a
+//file are submitted together, its head and tail reads once both are back,
+//and batches of all of them go to the kernel with a single system call.
+//Finished files are handed to the callback, on the reader's thread, with
+//what Id3v2Tag::Read() needs; files that could not be read come with an
+//empty pointer and are left to the synchronous path.
+//
+//Start() fails on kernels without io_uring, or without one of the
+//operations, and where it is blocked, e.g. by a seccomp profile; the
+//caller then reads on its own threads as before.
+class HeadReader {
+public:
+	typedef boost::shared_ptr<Id3v2Tag::file_head> head_ptr;
+	typedef boost::function<void (const fs::path &, head_ptr)> head_callback;
+	static const unsigned int DEFAULT_DEPTH = 64;
+
+	HeadReader(head_callback on_read, unsigned int depth = DEFAULT_DEPTH);
+	~HeadReader();
+
+	bool Start();
+	//Queues a file; blocks while the reader is far behind
+	void Submit(const fs::path &file);
+	//Returns once every submitted file was handed to the callback
+	void Drain();
+	void Stop();
+
+protected:
+	struct request;
+	struct ring;
+
+	void _thread_func();
+	bool Fill();
+	void Complete(unsigned long long user_data, int result);
+	void Finish(size_t slot, bool ok);
+
+protected:
+	head_callback _on_read;
+	unsigned int _depth;
+	ring *_ring;
+	boost::thread *_thread;
+	std::vector<request*> _requests;	//one per slot
+	std::vector<size_t> _free;			//slots not in flight
+	unsigned int _to_submit;			//prepared, not yet submitted
+	//Guarded by _mtx
+	boost::mutex _mtx;
+	boost::condition_variable _cv;
+	std::deque<fs::path> _queued;
+	size_t _pending;					//queued or in flight
+	bool _stop;
+};
+
+#endif /* HEADREADER_H_ */
@@ -0,0 +1,752 @@
+/*
+ * Id3v2.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Id3v2.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#ifndef BOOST_WINDOWS_API
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+namespace {
+	//Audio is moved in pieces this big when a tag grows
+	const size_t MOVE_CHUNK = 1024 * 1024;
+	const size_t HEADER_SIZE = 10;
+
+	unsigned char Byte(const std::string &s, size_t i)
+	{
+		return (unsigned char)s[i];
+	}
+
+	bool SyncSafe(const unsigned char *p, size_t &out)
+	{
+		if((p[0] | p[1] | p[2] | p[3]) & 0x80)
+			return false;
+		out = ((size_t)p[0] << 21) | ((size_t)p[1] << 14) | ((size_t)p[2] << 7) | p[3];
+		return true;
+	}
+
+	void AppendSize(std::string &out, size_t size, bool sync_safe)
+	{
+		int shift = sync_safe ? 7 : 8;
+		unsigned int mask = sync_safe ? 0x7F : 0xFF;
+		for(int i = 3; i >= 0; --i)
+			out += (char)((size >> (shift * i)) & mask);
+	}
+
+	//TagLib's String::toInt(): leading digits only
+	TagLib::uint LeadingNumber(const TagLib::String &s, size_t max_digits)
+	{
+		std::string narrow = s.to8Bit();
+		TagLib::uint value = 0;
+		for(size_t i = 0; i < narrow.size() && i < max_digits && narrow[i] >= '0' && narrow[i] <= '9'; ++i)
+			value = value * 10 + (narrow[i] - '0');
+		return value;
+	}
+
+	TagLib::String::Type EncodingType(unsigned char encoding)
+	{
+		switch(encoding) {
+		case 1: return TagLib::String::UTF16;
+		case 2: return TagLib::String::UTF16BE;
+		case 3: return TagLib::String::UTF8;
+		default: return TagLib::String::Latin1;
+		}
+	}
+
+	size_t TerminatorSize(unsigned char encoding)
+	{
+		return (encoding == 1 || encoding == 2) ? 2 : 1;
+	}
+
+	//Position of the first terminator at or after from, aligned for UTF-16
+	size_t FindTerminator(const std::string &bytes, size_t from, unsigned char encoding)
+	{
+		size_t width = TerminatorSize(encoding);
+		for(size_t i = from; i + width <= bytes.size(); i += width) {
+			if(bytes[i] == 0 && (width == 1 || bytes[i+1] == 0))
+				return i;
+		}
+		return std::string::npos;
+	}
+
+	TagLib::String Decode(const std::string &bytes, unsigned char encoding)
+	{
+		return TagLib::String(TagLib::ByteVector(bytes.data(), (unsigned int)bytes.size()), EncodingType(encoding));
+	}
+
+	//The text of a text frame as TagLib shows it: non-empty values joined by spaces
+	bool DecodeText(const std::string &bytes, size_t from, unsigned char encoding,
+			TagLib::String &out, size_t &values)
+	{
+		values = 0;
+		std::wstring text;
+		while(from < bytes.size()) {
+			size_t end = FindTerminator(bytes, from, encoding);
+			if(end == std::string::npos)
+				end = bytes.size();
+			if(end > from) {
+				if(values++)
+					text += L' ';
+				text += Decode(bytes.substr(from, end - from), encoding).toWString();
+			}
+			from = end + TerminatorSize(encoding);
+		}
+		out = TagLib::String(text);
+		return true;
+	}
+
+	std::string Encode(const TagLib::String &s, unsigned char encoding)
+	{
+		TagLib::ByteVector v = s.data(EncodingType(encoding));
+		return std::string(v.data(), v.size());
+	}
+
+	TagLib::String Number(TagLib::uint value)
+	{
+		std::ostringstream out;
+		out << value;
+		return TagLib::String(out.str());
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+Id3v2Tag::Id3v2Tag()
+: _fd(-1)
+, _map(NULL)
+, _map_size(0)
+, _padding(DEFAULT_PADDING)
+, _safe_rewrite(false)
+, _written(NotWritten)
+, _bytes_written(0)
+{
+	Clear();
+}
+
+Id3v2Tag::~Id3v2Tag()
+{
+#ifndef BOOST_WINDOWS_API
+	if(_fd >= 0)
+		::close(_fd);
+#endif
+	Unmap();
+}
+
+void Id3v2Tag::Clear()
+{
+	_file_size = 0;
+	_version = 0;
+	_flags = 0;
+	_tag_end = 0;
+	_frames_end = 0;
+	_head.clear();
+	_frames.clear();
+	for(size_t f = 0; f < FIELD_COUNT; ++f) {
+		_first[f] = -1;
+		_text[f] = TagLib::String();
+		_dirty[f] = false;
+	}
+	_year = 0;
+	_track = 0;
+	_comment_language = "XXX";
+	_comment_description = TagLib::String();
+}
+
+bool Id3v2Tag::modified() const
+{
+	for(size_t f = 0; f < FIELD_COUNT; ++f)
+		if(_dirty[f])
+			return true;
+	return false;
+}
+
+#ifdef BOOST_WINDOWS_API
+
+//The direct path relies on pread/pwrite; Windows always goes through TagLib
+bool Id3v2Tag::Read(const fs::path &)
+{
+	return false;
+}
+
+bool Id3v2Tag::Read(const fs::path &, file_head &)
+{
+	return false;
+}
+
+bool Id3v2Tag::Map(const fs::path &)
+{
+	return false;
+}
+
+void Id3v2Tag::Prefetch(const fs::path &)
+{
+}
+
+void Id3v2Tag::Unmap()
+{
+}
+
+bool Id3v2Tag::save()
+{
+	return false;
+}
+
+bool Id3v2Tag::Bytes(size_t, size_t, std::string &) const
+{
+	return false;
+}
+
+bool Id3v2Tag::Plan(patch &)
+{
+	return false;
+}
+
+bool Id3v2Tag::Apply(const fs::path &, const patch &)
+{
+	return false;
+}
+
+bool Id3v2Tag::Redo(const fs::path &, const patch &, bool &written)
+{
+	written = false;
+	return false;
+}
+
+#else
+
+bool Id3v2Tag::Read(const fs::path &file)
+{
+	Unmap();
+	file_head data;
+	int fd = ::open(file.c_str(), O_RDONLY);
+	struct stat st;
+	bool ok = fd >= 0 && fstat(fd, &st) == 0;
+	if(ok) {
+		data.size = st.st_size;
+		data.head.resize((size_t)std::min<unsigned long long>(data.size, HEAD_SIZE));
+		ok = !data.head.empty() && pread(fd, &data.head[0], data.head.size(), 0) == (ssize_t)data.head.size();
+	}
+	if(ok) {
+		size_t n = (size_t)std::min<unsigned long long>(data.size, TAIL_SIZE);
+		if(data.size <= data.head.size())
+			data.tail.assign(data.head, data.head.size() - n, n);
+		else {
+			data.tail.resize(n);
+			ok = pread(fd, &data.tail[0], n, data.size - n) == (ssize_t)n;
+		}
+	}
+	if(!ok) {
+		if(fd >= 0)
+			::close(fd);
+		Clear();
+		return false;
+	}
+	return Parse(file, data, fd);
+}
+
+bool Id3v2Tag::Read(const fs::path &file, file_head &data)
+{
+	Unmap();
+	return Parse(file, data, -1);
+}
+
+bool Id3v2Tag::Map(const fs::path &file)
+{
+	Unmap();
+	file_head data;
+	int fd = ::open(file.c_str(), O_RDONLY);
+	struct stat st;
+	bool ok = fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0;
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	if(ok) {
+		//The first page holds the header, which tells how much to map
+		data.size = st.st_size;
+		size_t size = (size_t)std::min<unsigned long long>(data.size, page);
+		void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		ok = m != MAP_FAILED;
+		const unsigned char *h = static_cast<const unsigned char*>(m);
+		size_t tag_size;
+		if(ok && size >= HEADER_SIZE && memcmp(h, "ID3", 3) == 0 && SyncSafe(h + 6, tag_size)) {
+			size_t want = (size_t)std::min<unsigned long long>(data.size, HEADER_SIZE + tag_size);
+			if(want > size) {
+				munmap(m, size);
+				size = want;
+				m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+				ok = m != MAP_FAILED;
+			}
+		}
+		if(ok) {
+			madvise(m, size, MADV_WILLNEED);
+			_map = static_cast<const char*>(m);
+			_map_size = size;
+			data.head.assign(_map, std::min(size, HEADER_SIZE));
+		}
+	}
+	if(ok) {
+		size_t n = (size_t)std::min<unsigned long long>(data.size, TAIL_SIZE);
+		if(data.size <= _map_size)
+			data.tail.assign(_map + data.size - n, n);
+		else {
+			//Mappings start on a page
+			unsigned long long offset = (data.size - n) & ~(unsigned long long)(page - 1);
+			size_t size = (size_t)(data.size - offset);
+			void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, offset);
+			ok = m != MAP_FAILED;
+			if(ok) {
+				data.tail.assign(static_cast<const char*>(m) + size - n, n);
+				munmap(m, size);
+			}
+		}
+	}
+	if(!ok) {
+		if(fd >= 0)
+			::close(fd);
+		Unmap();
+		Clear();
+		return false;
+	}
+	return Parse(file, data, fd);
+}
+
+void Id3v2Tag::Unmap()
+{
+	if(_map)
+		munmap(const_cast<char*>(_map), _map_size);
+	_map = NULL;
+	_map_size = 0;
+}
+
+void Id3v2Tag::Prefetch(const fs::path &file)
+{
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if(fd < 0)
+		return;
+	struct stat st;
+	if(fstat(fd, &st) == 0) {
+		posix_fadvise(fd, 0, std::min<off_t>(st.st_size, HEAD_SIZE), POSIX_FADV_WILLNEED);
+		if(st.st_size > (off_t)HEAD_SIZE)
+			posix_fadvise(fd, std::max<off_t>(st.st_size - TAIL_SIZE, HEAD_SIZE), 0, POSIX_FADV_WILLNEED);
+	}
+	::close(fd);
+}
+
+//Takes over fd, if any
+bool Id3v2Tag::Parse(const fs::path &file, file_head &data, int fd)
+{
+	Clear();
+	_file = file;
+	_fd = fd;
+	_file_size = data.size;
+	_head.swap(data.head);
+	bool ok = !_head.empty();
+	if(ok) {
+		const unsigned char *h = reinterpret_cast<const unsigned char*>(_head.data());
+		size_t size;
+		if(_head.size() >= 2 && h[0] == 0xFF && (h[1] & 0xE0) == 0xE0) {
+			_version = 4;			//no tag yet, the audio starts right away
+			_flags = 0;
+		} else {
+			ok = _head.size() >= HEADER_SIZE && memcmp(h, "ID3", 3) == 0
+				&& (h[3] == 3 || h[3] == 4) && h[4] != 0xFF
+				&& !(h[5] & ~0x20)			//no unsynchronisation, extended header or footer
+				&& SyncSafe(h + 6, size);
+			if(ok) {
+				_version = h[3];
+				_flags = h[5];
+				_tag_end = HEADER_SIZE + size;
+				ok = _tag_end <= _file_size;
+			}
+		}
+	}
+	//Tags at the end would be left stale; TagLib updates them too
+	if(ok && _file_size >= _tag_end + 128) {
+		size_t n = (size_t)std::min<unsigned long long>(data.tail.size(), _file_size - _tag_end);
+		const char *tail = data.tail.data() + data.tail.size() - n;
+		ok = n >= 128
+			&& memcmp(tail + n - 128, "TAG", 3) != 0
+			&& memcmp(tail + n - 32, "APETAGEX", 8) != 0;
+	}
+	//Frames past the head are read from the mapping or the file
+	if(ok && _fd < 0 && _tag_end > std::max(_head.size(), _map_size)) {
+		_fd = ::open(file.c_str(), O_RDONLY);
+		ok = _fd >= 0;
+	}
+	if(ok)
+		ok = ParseFrames();
+	if(_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+	return ok;
+}
+
+bool Id3v2Tag::Bytes(size_t offset, size_t size, std::string &out) const
+{
+	if(offset + size <= _head.size()) {
+		out.assign(_head, offset, size);
+		return true;
+	}
+	if(offset + size <= _map_size) {
+		out.assign(_map + offset, size);
+		return true;
+	}
+	out.resize(size);
+	return _fd >= 0 && (!size || pread(_fd, &out[0], size, offset) == (ssize_t)size);
+}
+
+bool Id3v2Tag::save()
+{
+	_written = NotWritten;
+	_bytes_written = 0;
+	if(!modified())
+		return true;
+
+	patch p;
+	bool ok;
+	if(Plan(p)) {
+		//Fits: one write of the changed frames, padding absorbs the difference
+		ok = Apply(_file, p);
+		_written = InPlace;
+		_bytes_written = p.bytes.size();
+	} else {
+		//Does not fit: a new tag with room for later edits, the audio moves back
+		_fd = ::open(_file.c_str(), _safe_rewrite ? O_RDONLY : O_RDWR);
+		std::string frames;
+		ok = _fd >= 0 && RenderFrames(0, frames) && frames.size() <= MAX_TAG_SIZE;
+		if(ok)
+			ok = _safe_rewrite ? RewriteCopy(BuildTag(frames)) : Rewrite(BuildTag(frames));
+		if(_fd >= 0)
+			::close(_fd);
+		_fd = -1;
+	}
+	if(ok) {
+		for(size_t f = 0; f < FIELD_COUNT; ++f)
+			_dirty[f] = false;
+	}
+	return ok;
+}
+
+bool Id3v2Tag::Plan(patch &out)
+{
+	if(!_tag_end)
+		return false;
+	//Frames before the first changed one stay where they are
+	size_t first_changed = _frames.size();
+	for(size_t f = 0; f < FIELD_COUNT; ++f)
+		if(_dirty[f] && _first[f] >= 0 && (size_t)_first[f] < first_changed)
+			first_changed = _first[f];
+
+	bool opened = false;
+	if(_fd < 0 && _tag_end > std::max(_head.size(), _map_size)) {
+		_fd = ::open(_file.c_str(), O_RDONLY);
+		opened = true;
+	}
+	std::string frames;
+	bool ok = RenderFrames(first_changed, frames);
+	if(opened) {
+		if(_fd >= 0)
+			::close(_fd);
+		_fd = -1;
+	}
+	size_t region = first_changed < _frames.size() ? _frames[first_changed].offset : _frames_end;
+	if(!ok || region + frames.size() > _tag_end)
+		return false;
+	if(region + frames.size() < _frames_end)
+		frames.append(_frames_end - region - frames.size(), '\0');	//clear what the old frames leave behind
+	out.offset = region;
+	out.file_size = _file_size;
+	out.bytes.swap(frames);
+	return true;
+}
+
+bool Id3v2Tag::Apply(const fs::path &file, const patch &p)
+{
+	int fd = ::open(file.c_str(), O_RDWR);
+	if(fd < 0)
+		return false;
+	bool ok = pwrite(fd, p.bytes.data(), p.bytes.size(), p.offset) == (ssize_t)p.bytes.size();
+	::close(fd);
+	return ok;
+}
+
+bool Id3v2Tag::Redo(const fs::path &file, const patch &p, bool &written)
+{
+	written = false;
+	int fd = ::open(file.c_str(), O_RDWR);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	std::string current(p.bytes.size(), '\0');
+	bool ok = fstat(fd, &st) == 0 && (unsigned long long)st.st_size == p.file_size
+		&& (current.empty() || pread(fd, &current[0], current.size(), p.offset) == (ssize_t)current.size());
+	if(ok && current != p.bytes) {
+		ok = pwrite(fd, p.bytes.data(), p.bytes.size(), p.offset) == (ssize_t)p.bytes.size();
+		written = ok;
+	}
+	::close(fd);
+	return ok;
+}
+
+//Frames from index first on, in their order, with ours changed or appended
+bool Id3v2Tag::RenderFrames(size_t first, std::string &out) const
+{
+	for(size_t i = first; i < _frames.size(); ++i) {
+		const frame &f = _frames[i];
+		if(f.field >= 0 && _first[f.field] == (int)i && _dirty[f.field]) {
+			out += RenderFrame((Field)f.field);
+		} else {
+			std::string bytes;
+			if(!Bytes(f.offset, HEADER_SIZE + f.size, bytes))
+				return false;
+			out += bytes;
+		}
+	}
+	for(size_t f = 0; f < FIELD_COUNT; ++f)
+		if(_dirty[f] && _first[f] < 0)
+			out += RenderFrame((Field)f);
+	return true;
+}
+
+//The padding is cut short where the size would no longer fit the header
+std::string Id3v2Tag::BuildTag(const std::string &frames) const
+{
+	size_t room = MAX_TAG_SIZE - frames.size();
+	size_t padding = std::min(_padding, room);
+	size_t tag_size = frames.size() + padding;
+	std::string tag("ID3", 3);
+	tag += (char)_version;
+	tag += '\0';
+	tag += (char)_flags;
+	AppendSize(tag, tag_size, true);
+	tag += frames;
+	tag.append(padding, '\0');
+	return tag;
+}
+
+//Like TagLib's insert: the file grows in place, so its inode, links and
+//permissions are kept; the audio is moved from the end backwards in chunks
+bool Id3v2Tag::Rewrite(const std::string &tag)
+{
+	unsigned long long old_end = _tag_end;
+	unsigned long long shift = tag.size() - old_end;	//> 0, the frames did not fit
+	std::vector<char> buffer(MOVE_CHUNK);
+	for(unsigned long long end = _file_size; end > old_end; ) {
+		size_t n = (size_t)std::min<unsigned long long>(buffer.size(), end - old_end);
+		unsigned long long start = end - n;
+		if(pread(_fd, &buffer[0], n, start) != (ssize_t)n
+			|| pwrite(_fd, &buffer[0], n, start + shift) != (ssize_t)n)
+			return false;
+		end = start;
+	}
+	if(pwrite(_fd, tag.data(), tag.size(), 0) != (ssize_t)tag.size())
+		return false;
+
+	_written = Rewritten;
+	_bytes_written = _file_size - old_end + tag.size();
+	_file_size += shift;
+	return true;
+}
+
+bool Id3v2Tag::RewriteCopy(const std::string &tag)
+{
+	struct stat st;
+	if(fstat(_fd, &st) != 0)
+		return false;
+	fs::path tmp = TempPathFor(_file);
+	int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+	if(out < 0)
+		return false;
+	bool ok = ::write(out, tag.data(), tag.size()) == (ssize_t)tag.size();
+	std::vector<char> buffer(MOVE_CHUNK);
+	for(unsigned long long pos = _tag_end; ok && pos < _file_size; ) {
+		size_t n = (size_t)std::min<unsigned long long>(buffer.size(), _file_size - pos);
+		ok = pread(_fd, &buffer[0], n, pos) == (ssize_t)n && ::write(out, &buffer[0], n) == (ssize_t)n;
+		pos += n;
+	}
+	ok = ok && fsync(out) == 0;
+	ok = ::close(out) == 0 && ok;
+	ok = ok && ::rename(tmp.c_str(), _file.c_str()) == 0;
+	if(!ok) {
+		::unlink(tmp.c_str());
+		return false;
+	}
+	_written = Rewritten;
+	_bytes_written = _file_size - _tag_end + tag.size();
+	_file_size += tag.size() - _tag_end;
+	return true;
+}
+
+#endif
+
+int Id3v2Tag::FieldOf(const char *id) const
+{
+	if(!memcmp(id, "TIT2", 4)) return FieldTitle;
+	if(!memcmp(id, "TPE1", 4)) return FieldArtist;
+	if(!memcmp(id, "TALB", 4)) return FieldAlbum;
+	if(!memcmp(id, "COMM", 4)) return FieldComment;
+	if(!memcmp(id, "TCON", 4)) return FieldGenre;
+	if(!memcmp(id, "TRCK", 4)) return FieldTrack;
+	if(!memcmp(id, _version == 3 ? "TYER" : "TDRC", 4)) return FieldYear;
+	return -1;
+}
+
+bool Id3v2Tag::ParseFrames()
+{
+	if(!_tag_end)
+		return true;
+	size_t pos = HEADER_SIZE;
+	while(pos + HEADER_SIZE <= _tag_end) {
+		std::string header;
+		if(!Bytes(pos, HEADER_SIZE, header))
+			return false;
+		if(header[0] == 0)
+			break;					//padding
+		for(size_t i = 0; i < 4; ++i)
+			if(!((header[i] >= 'A' && header[i] <= 'Z') || (header[i] >= '0' && header[i] <= '9')))
+				return false;
+
+		frame f;
+		memcpy(f.id, header.data(), 4);
+		f.offset = pos;
+		if(_version == 4) {
+			if(!SyncSafe(reinterpret_cast<const unsigned char*>(header.data()) + 4, f.size))
+				return false;
+		} else
+			f.size = ((size_t)Byte(header, 4) << 24) | (Byte(header, 5) << 16) | (Byte(header, 6) << 8) | Byte(header, 7);
+		if(pos + HEADER_SIZE + f.size > _tag_end)
+			return false;
+		f.field = FieldOf(f.id);
+
+		if(f.field >= 0) {
+			//Compression, encryption, grouping, unsynchronisation, data length
+			unsigned char format = Byte(header, 9);
+			if(format & (_version == 4 ? 0x4F : 0xE0))
+				return false;
+			if(_first[f.field] >= 0) {
+				if(f.field == FieldComment)
+					return false;	//TagLib would pick by description
+			} else {
+				_first[f.field] = (int)_frames.size();
+				std::string content;
+				if(!Bytes(pos + HEADER_SIZE, f.size, content) || !DecodeFrame((Field)f.field, content))
+					return false;
+			}
+		}
+		_frames.push_back(f);
+		pos += HEADER_SIZE + f.size;
+	}
+	_frames_end = pos;
+	return true;
+}
+
+bool Id3v2Tag::DecodeFrame(Field field, const std::string &content)
+{
+	if(content.empty() || Byte(content, 0) > 3)
+		return false;
+	unsigned char encoding = Byte(content, 0);
+	size_t values;
+	TagLib::String text;
+
+	if(field == FieldComment) {
+		if(content.size() < 4)
+			return false;
+		_comment_language = content.substr(1, 3);
+		size_t end = FindTerminator(content, 4, encoding);
+		if(end == std::string::npos)
+			return false;
+		_comment_description = Decode(content.substr(4, end - 4), encoding);
+		std::string rest = content.substr(end + TerminatorSize(encoding));
+		_text[FieldComment] = Decode(rest.substr(0, FindTerminator(rest, 0, encoding)), encoding);
+		return true;
+	}
+
+	if(!DecodeText(content, 1, encoding, text, values))
+		return false;
+	switch(field) {
+	case FieldGenre: {
+		//References to ID3v1 genres need TagLib's genre list
+		std::string narrow = text.to8Bit();
+		if(values > 1 || (!narrow.empty() && (narrow[0] == '(' || (narrow.find_first_not_of("0123456789") == std::string::npos))))
+			return false;
+		_text[field] = text;
+		return true;
+	}
+	case FieldYear:
+		_year = LeadingNumber(text, 4);
+		return true;
+	case FieldTrack:
+		_track = LeadingNumber(text, std::string::npos);
+		return true;
+	default:
+		_text[field] = text;
+		return true;
+	}
+}
+
+void Id3v2Tag::SetText(Field field, const TagLib::String &s)
+{
+	if(_text[field] == s)
+		return;
+	_text[field] = s;
+	_dirty[field] = true;
+}
+
+void Id3v2Tag::setYear(TagLib::uint i)
+{
+	if(_year == i)
+		return;
+	_year = i;
+	_dirty[FieldYear] = true;
+}
+
+void Id3v2Tag::setTrack(TagLib::uint i)
+{
+	if(_track == i)
+		return;
+	_track = i;
+	_dirty[FieldTrack] = true;
+}
+
+//Empty values remove the frame, as in TagLib
+std::string Id3v2Tag::RenderFrame(Field field) const
+{
+	TagLib::String value;
+	const char *id;
+	switch(field) {
+	case FieldTitle: id = "TIT2"; value = _text[field]; break;
+	case FieldArtist: id = "TPE1"; value = _text[field]; break;
+	case FieldAlbum: id = "TALB"; value = _text[field]; break;
+	case FieldComment: id = "COMM"; value = _text[field]; break;
+	case FieldGenre: id = "TCON"; value = _text[field]; break;
+	case FieldYear: id = _version == 3 ? "TYER" : "TDRC"; if(_year) value = Number(_year); break;
+	case FieldTrack: id = "TRCK"; if(_track) value = Number(_track); break;
+	default: return std::string();
+	}
+	if(value.isEmpty())
+		return std::string();
+
+	bool latin1 = value.isLatin1() && (field != FieldComment || _comment_description.isLatin1());
+	unsigned char encoding = latin1 ? 0 : (_version == 4 ? 3 : 1);
+	std::string content(1, (char)encoding);
+	if(field == FieldComment) {
+		content += _comment_language;
+		content += Encode(_comment_description, encoding);
+		content.append(TerminatorSize(encoding), '\0');
+	}
+	content += Encode(value, encoding);
+
+	std::string out(id, 4);
+	AppendSize(out, content.size(), _version == 4);
+	out.append(2, '\0');			//flags
+	out += content;
+	return out;
+}
@@ -0,0 +1,157 @@
+/*
+ * Id3v2.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef ID3V2_H_
+#define ID3V2_H_
+
+#define TAGLIB_STATIC
+
+#include <taglib/tag.h>
+#include <taglib/tstring.h>
+#include <string>
+#include <vector>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Direct reader/writer for the ID3v2.3/2.4 tag at the start of an MP3 file.
+//
+//Reads the tag with one pread of the file head instead of going through
+//TagLib's format detection and frame model, and only decodes the frames
+//behind TagLib::Tag's fields. save() rewrites the tag in place, from the
+//first changed frame on, as long as the frames still fit in the tag's
+//padding; the size of the file does not change. Otherwise the tag is
+//rebuilt with SetPadding() bytes to spare, so that later edits fit, and
+//the audio behind it is moved.
+//
+//Read() refuses everything else, leaving it to TagLib: other versions,
+//unsynchronisation, extended headers, footers, compressed or encrypted
+//frames among ours, genre references like "(17)", several comments, and
+//files that also carry ID3v1 or APE tags. A file without any tag is taken
+//if it starts with an MPEG frame; it gets an ID3v2.4 tag. Unlike TagLib's
+//save, no ID3v1 tag is added and the version is kept.
+class Id3v2Tag : public TagLib::Tag {
+public:
+	enum WriteKind {NotWritten, InPlace, Rewritten};
+	static const size_t DEFAULT_PADDING = 4096;
+	static const size_t MAX_TAG_SIZE = 0x0FFFFFFF;	//frames + padding, a 28-bit syncsafe integer
+	static const size_t HEAD_SIZE = 64 * 1024;	//one read covers the tag of most files
+	static const size_t TAIL_SIZE = 160;		//room for an ID3v1 tag or an APE footer
+
+	//What Read() needs of a file, when something else already read it
+	struct file_head {
+		unsigned long long size;
+		std::string head;			//the first min(size, HEAD_SIZE) bytes
+		std::string tail;			//the last min(size, TAIL_SIZE) bytes
+		file_head() : size(0) {}
+	};
+
+	Id3v2Tag();
+	virtual ~Id3v2Tag();
+
+	void SetPadding(size_t bytes) { _padding = bytes; }
+
+	//False if the file has to go through TagLib
+	bool Read(const fs::path &file);
+	//The same from bytes read ahead; takes over data's buffers. The file is
+	//only opened if the tag reaches past the head.
+	bool Read(const fs::path &file, file_head &data);
+	//The same through a mapping of the tag, sized from its header, and of
+	//the last bytes; frames are copied out of the mapping as they are needed
+	bool Map(const fs::path &file);
+	//Asks the kernel to read the head and tail of a file in the background
+	static void Prefetch(const fs::path &file);
+
+	//A write of the changed frames into the tag as it is
+	struct patch {
+		unsigned long long offset;
+		unsigned long long file_size;	//of the file it is meant for
+		std::string bytes;
+	};
+	//False if the frames do not fit, so save() would rebuild the tag
+	bool Plan(patch &out);
+	static bool Apply(const fs::path &file, const patch &p);
+	//Applies a patch again, e.g. after a crash, if the file still has the
+	//planned size; written tells whether the bytes were not there yet
+	static bool Redo(const fs::path &file, const patch &p, bool &written);
+	//Rebuilt tags go into a copy renamed over the file instead of moving the
+	//audio in place: a crash leaves either version, but the inode changes
+	void SetSafeRewrite(bool safe) { _safe_rewrite = safe; }
+	bool save();
+	bool modified() const;
+	//How the last save() wrote, and how many bytes
+	WriteKind written() const { return _written; }
+	unsigned long long bytes_written() const { return _bytes_written; }
+
+	unsigned long long file_size() const { return _file_size; }
+	unsigned int version() const { return _version; }
+
+	//TagLib::Tag
+	virtual TagLib::String title() const { return _text[FieldTitle]; }
+	virtual TagLib::String artist() const { return _text[FieldArtist]; }
+	virtual TagLib::String album() const { return _text[FieldAlbum]; }
+	virtual TagLib::String comment() const { return _text[FieldComment]; }
+	virtual TagLib::String genre() const { return _text[FieldGenre]; }
+	virtual TagLib::uint year() const { return _year; }
+	virtual TagLib::uint track() const { return _track; }
+	virtual void setTitle(const TagLib::String &s) { SetText(FieldTitle, s); }
+	virtual void setArtist(const TagLib::String &s) { SetText(FieldArtist, s); }
+	virtual void setAlbum(const TagLib::String &s) { SetText(FieldAlbum, s); }
+	virtual void setComment(const TagLib::String &s) { SetText(FieldComment, s); }
+	virtual void setGenre(const TagLib::String &s) { SetText(FieldGenre, s); }
+	virtual void setYear(TagLib::uint i);
+	virtual void setTrack(TagLib::uint i);
+
+protected:
+	enum Field {FieldTitle = 0, FieldArtist, FieldAlbum, FieldComment, FieldGenre, FieldYear, FieldTrack, FIELD_COUNT};
+
+	struct frame {
+		char id[4];
+		size_t offset;				//of the frame header, from the start of the file
+		size_t size;				//without the header
+		int field;					//one of ours, or -1
+	};
+
+	void Clear();
+	void Unmap();
+	bool Parse(const fs::path &file, file_head &data, int fd);
+	bool Bytes(size_t offset, size_t size, std::string &out) const;	//from the head or the file
+	bool ParseFrames();
+	bool DecodeFrame(Field field, const std::string &content);
+	int FieldOf(const char *id) const;
+	void SetText(Field field, const TagLib::String &s);
+	std::string RenderFrame(Field field) const;
+	bool RenderFrames(size_t first, std::string &out) const;
+	std::string BuildTag(const std::string &frames) const;
+	bool Rewrite(const std::string &tag);
+	bool RewriteCopy(const std::string &tag);
+
+protected:
+	fs::path _file;
+	int _fd;						//open during Read() and save(), if needed
+	unsigned long long _file_size;
+	unsigned int _version;			//3 or 4
+	unsigned char _flags;			//of the tag header
+	size_t _tag_end;				//header + frames + padding, 0 without a tag
+	size_t _frames_end;				//start of the padding
+	std::string _head;				//the first bytes of the file, usually the whole tag
+	const char *_map;				//the tag, after Map()
+	size_t _map_size;
+	std::vector<frame> _frames;
+	int _first[FIELD_COUNT];		//index in _frames of the frame TagLib would use, -1 if none
+	TagLib::String _text[FIELD_COUNT];	//title to genre
+	TagLib::uint _year;
+	TagLib::uint _track;
+	std::string _comment_language;	//of the existing comment
+	TagLib::String _comment_description;
+	bool _dirty[FIELD_COUNT];
+	size_t _padding;				//left free when the tag is rebuilt
+	bool _safe_rewrite;
+	WriteKind _written;
+	unsigned long long _bytes_written;
+};
+
+#endif /* ID3V2_H_ */
@@ -0,0 +1,307 @@
+/*
+ * Journal.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Journal.h"
+#include "RunIndex.h"
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <boost/bind.hpp>
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	const char JOURNAL_MAGIC[8] = {'M','P','3','T','J','R','N','1'};
+	const size_t JOURNAL_HEADER = sizeof(JOURNAL_MAGIC) + 8;	//magic, settings hash
+	//Records that need no sync are written at least this often, or once this much queued up
+	const long FLUSH_INTERVAL_MS = 100;
+	const size_t FLUSH_SIZE = 64 * 1024;
+	//Appended since the journal last started over before it starts over again,
+	//at least; more if that many bytes already went into the new journal
+	const size_t CHECKPOINT_SIZE = 16 * 1024 * 1024;
+
+	struct update {
+		fs::path file;
+		bool has_patch;
+		Id3v2Tag::patch patch;
+	};
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+Journal::Journal(const fs::path &file)
+: _file(file)
+, _settings_hash(0)
+, _thread(NULL)
+, _appended(0)
+, _base_size(0)
+, _buffer_sync(false)
+, _seq(0)
+, _durable(0)
+, _failed(false)
+, _stop(false)
+{
+}
+
+Journal::~Journal()
+{
+	if(_thread) {
+		{
+			boost::lock_guard<boost::mutex> lock(_mtx);
+			_stop = true;
+			_cv.notify_all();
+		}
+		_thread->join();
+		delete _thread;
+	}
+}
+
+bool Journal::Open(boost::uint64_t settings_hash)
+{
+	std::string content;
+	{
+		std::ifstream in(_file.string().c_str(), std::ios::binary);
+		if(in)
+			content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	if(!content.empty()) {
+		if(content.size() < JOURNAL_HEADER || memcmp(content.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) {
+			LogError << _T("Journal ") << _file.string<tstring>() << _T(" is not a journal, leaving it alone") << std::endl;
+			return false;
+		}
+		boost::uint64_t hash;
+		memcpy(&hash, content.data() + sizeof(JOURNAL_MAGIC), sizeof(hash));
+		size_t redone = Recover(content, hash == settings_hash);
+		Log << _T("Journal: resuming an interrupted run, ") << _done.size() << _T(" files done, ")
+			<< redone << _T(" writes redone") << std::endl;
+		if(hash != settings_hash)
+			Log << _T("Journal: patterns or options changed, every file is tagged again") << std::endl;
+	}
+
+	//Start over with what is left to know: the files already finished
+	_settings_hash = settings_hash;
+	if(!Replace(Snapshot()))
+		return false;
+	_thread = new boost::thread(boost::bind(&Journal::_thread_func, this));
+	return true;
+}
+
+//Redoes the last in-place write of every file, removes copies that were never
+//renamed into place, and collects the finished files; returns the writes redone
+size_t Journal::Recover(const std::string &content, bool same_settings)
+{
+	std::map<fs::path, update> last;	//a file may be updated twice while watching
+	const char *p = content.data() + JOURNAL_HEADER;
+	const char *end = content.data() + content.size();
+	int type;
+	boost::uint64_t number;
+	const char *record, *body_end;
+	//Up to the end, or to a record torn by the crash
+	while(NextRecord(p, end, type, number, record, body_end)) {
+		if(type == Update) {
+			update u;
+			tag_values before, after;
+			unsigned char has_patch;
+			if(!GetPath(record, body_end, u.file) || !before.Decode(record, body_end) || !after.Decode(record, body_end)
+				|| !Get(record, body_end, has_patch))
+				break;
+			u.has_patch = has_patch != 0;
+			if(u.has_patch && (!Get(record, body_end, u.patch.offset) || !Get(record, body_end, u.patch.file_size)
+					|| !GetBytes(record, body_end, u.patch.bytes)))
+				break;
+			last[u.file] = u;
+		} else if(type == Handled && same_settings) {
+			fs::path file;
+			if(GetPath(record, body_end, file))		//older journals only held its hash
+				_done.insert(file);
+		}
+	}
+
+	size_t redone = 0;
+	for(std::map<fs::path, update>::const_iterator it = last.begin(); it != last.end(); ++it) {
+		const update &u = it->second;
+		if(u.has_patch) {
+			//Even a finished write may not have reached the disk
+			bool written;
+			if(!Id3v2Tag::Redo(u.file, u.patch, written))
+				LogError << _T("Journal: cannot check ") << u.file.string<tstring>() << std::endl;
+			redone += written;
+		} else {
+			boost::system::error_code ec;
+			fs::remove(TempPathFor(u.file), ec);
+		}
+	}
+	return redone;
+}
+
+//The header, the finished files and the updates of writes still under way
+std::string Journal::Snapshot() const
+{
+	std::string start(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+	PutU64(start, _settings_hash);
+	const std::set<fs::path> *sets[] = {&_done, &_finished};
+	for(size_t i = 0; i < 2; ++i)
+		for(std::set<fs::path>::const_iterator it = sets[i]->begin(); it != sets[i]->end(); ++it) {
+			std::string rest;
+			PutPath(rest, *it);
+			PutRecord(start, Handled, RunIndex::HashPath(*it), rest);
+		}
+	for(std::map<fs::path, std::string>::const_iterator it = _writing.begin(); it != _writing.end(); ++it)
+		start += it->second;
+	return start;
+}
+
+//Writes content aside, then renames it over the journal and appends from there
+bool Journal::Replace(const std::string &content)
+{
+	fs::path tmp = _file;
+	tmp += ".tmp";
+	{
+		std::ofstream out(tmp.string().c_str(), std::ios::binary | std::ios::trunc);
+		out.write(content.data(), content.size());
+		out.close();
+		if(!out || !SyncFile(tmp)) {
+			LogError << _T("Cannot write journal ") << tmp.string<tstring>() << std::endl;
+			boost::system::error_code ec;
+			fs::remove(tmp, ec);
+			return false;
+		}
+	}
+	boost::system::error_code ec;
+	fs::rename(tmp, _file, ec);
+	if(ec) {
+		LogError << _T("Cannot replace journal ") << _file.string<tstring>() << std::endl;
+		return false;
+	}
+	if(_out.is_open())
+		_out.close();
+	_out.clear();
+	_out.open(_file.string().c_str(), std::ios::binary | std::ios::app);
+	_appended = 0;
+	_base_size = content.size();
+	return _out.good();
+}
+
+bool Journal::IsDone(const fs::path &file)
+{
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	if(!_done.erase(file))
+		return false;
+	//Still finished if this run is interrupted too
+	_finished.insert(file);
+	return true;
+}
+
+void Journal::Begin(const fs::path &file, const tag_values &before, const tag_values &after,
+		const Id3v2Tag::patch *patch)
+{
+	std::string rest;
+	PutPath(rest, file);
+	before.Encode(rest);
+	after.Encode(rest);
+	rest += (char)(patch != NULL);
+	if(patch) {
+		PutU64(rest, patch->offset);
+		PutU64(rest, patch->file_size);
+		PutBytes(rest, patch->bytes.data(), patch->bytes.size());
+	}
+
+	boost::unique_lock<boost::mutex> lock(_mtx);
+	boost::uint64_t seq = ++_seq;
+	std::string &record = _writing[file];
+	record.clear();
+	PutRecord(record, Update, seq, rest);
+	_buffer += record;
+	_buffer_sync = true;
+	_cv.notify_all();
+	while(_durable < seq && !_failed)
+		_cv.wait(lock);
+	if(_failed)
+		throw Exc("Cannot write the journal");
+}
+
+void Journal::Finished(const fs::path &file)
+{
+	std::string rest;
+	PutPath(rest, file);
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	PutRecord(_buffer, Handled, RunIndex::HashPath(file), rest);
+	_finished.insert(file);
+	_writing.erase(file);
+}
+
+void Journal::Close()
+{
+	if(!_thread)
+		return;
+	{
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		_stop = true;
+		_cv.notify_all();
+	}
+	_thread->join();
+	delete _thread;
+	_thread = NULL;
+	_out.close();
+	boost::system::error_code ec;
+	fs::remove(_file, ec);
+}
+
+//Group commit: every update queued while the previous batch was synced goes
+//out with the next write and shares its sync
+void Journal::_thread_func()
+{
+	boost::unique_lock<boost::mutex> lock(_mtx);
+	for(;;) {
+		while(!_stop && !_buffer_sync && _buffer.size() < FLUSH_SIZE) {
+			if(_buffer.empty())
+				_cv.wait(lock);
+			else if(!_cv.timed_wait(lock, boost::posix_time::milliseconds(FLUSH_INTERVAL_MS)))
+				break;
+		}
+		if(_buffer.empty()) {
+			if(_stop)
+				return;
+			continue;
+		}
+		std::string batch;
+		batch.swap(_buffer);
+		bool sync = _buffer_sync;
+		_buffer_sync = false;
+		boost::uint64_t upto = _seq;
+		lock.unlock();
+
+		_out.write(batch.data(), batch.size());
+		_out.flush();
+		bool ok = _out && (!sync || SyncFile(_file));
+
+		lock.lock();
+		if(!ok && !_failed) {
+			_failed = true;
+			LogError << _T("Cannot write journal ") << _file.string<tstring>() << std::endl;
+		}
+		_durable = upto;
+		_cv.notify_all();
+
+		//Starting over only takes what is in memory; records still in the
+		//buffer go to the new journal
+		_appended += batch.size();
+		if(ok && _appended > std::max(CHECKPOINT_SIZE, _base_size)) {
+			std::string content = Snapshot();
+			lock.unlock();
+			bool replaced = Replace(content);
+			lock.lock();
+			if(!replaced) {
+				_appended = 0;			//kept appending to the old one; tried again later
+				if(!_out.good() && !_failed) {
+					_failed = true;
+					LogError << _T("Cannot write journal ") << _file.string<tstring>() << std::endl;
+					_cv.notify_all();
+				}
+			}
+		}
+	}
+}
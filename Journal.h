@@ -0,0 +1,86 @@
+/*
+ * Journal.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <boost/cstdint.hpp>
+#include "common.h"
+#include "Id3v2.h"
+#include "TagValues.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Write-ahead journal of the tag updates of a run.
+//
+//Before a file is written, its update (path, old and new values, and for
+//an in-place ID3v2 write the exact bytes) is appended and must be on disk.
+//The workers do not sync one by one: Begin() queues the record and waits,
+//while one thread writes whatever has queued up and syncs it once for all
+//of them. Every finished file is recorded too, written with the next batch.
+//
+//A journal left behind by an interrupted run is read by Open(): the last
+//in-place write of each file is redone where the file does not hold it,
+//copies of files rebuilt aside are removed, and finished files are
+//reported by IsDone() so the run can skip them, once each. A complete run
+//removes the journal.
+//
+//A long run, or a watch, would grow the journal without end, so once
+//enough has been appended since the last time it starts over the way
+//Open() does: the finished files, and the updates of writes not known to
+//be finished, are written to a new file that replaces it.
+class Journal {
+public:
+	explicit Journal(const fs::path &file);
+	~Journal();
+
+	//Recovers what an interrupted run left behind; the finished files only
+	//count if it ran with the same settings
+	bool Open(boost::uint64_t settings_hash);
+	//Only true on the first visit of the file in the resumed run
+	bool IsDone(const fs::path &file);
+	//Returns once the update is on disk; patch is the planned in-place write, if any
+	void Begin(const fs::path &file, const tag_values &before, const tag_values &after,
+			const Id3v2Tag::patch *patch);
+	//Written, rejected or left alone; not waited for
+	void Finished(const fs::path &file);
+	//Removes the journal after a complete run
+	void Close();
+
+protected:
+	enum RecordType {Update = 1, Handled};
+
+	void _thread_func();
+	size_t Recover(const std::string &content, bool same_settings);
+	std::string Snapshot() const;
+	bool Replace(const std::string &content);
+
+protected:
+	fs::path _file;
+	std::ofstream _out;
+	boost::uint64_t _settings_hash;
+	boost::thread *_thread;
+	size_t _appended;				//bytes written since the journal started over
+	size_t _base_size;				//of the journal when it started over
+	//Guarded by _mtx
+	boost::mutex _mtx;
+	std::set<fs::path> _done;		//files finished by the interrupted run, not visited yet
+	std::set<fs::path> _finished;	//files finished in this run
+	std::map<fs::path, std::string> _writing;	//update records of writes not finished
+	boost::condition_variable _cv;
+	std::string _buffer;			//records not written yet
+	bool _buffer_sync;				//the buffer holds an update, so it must be synced
+	boost::uint64_t _seq;			//last update begun
+	boost::uint64_t _durable;		//updates up to this one are on disk
+	bool _failed;
+	bool _stop;
+};
+
+#endif /* JOURNAL_H_ */
@@ -0,0 +1,262 @@
+/*
+ * Metrics.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Metrics.h"
+#include <iomanip>
+
+namespace pt = boost::posix_time;
+
+static pt::ptime Now()
+{
+	return pt::microsec_clock::universal_time();
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+latency_histogram::latency_histogram()
+: _count(0)
+, _sum(0)
+, _max(0)
+{
+	for(size_t b = 0; b < BUCKETS; ++b)
+		_buckets[b] = 0;
+}
+
+void latency_histogram::add(unsigned long long us)
+{
+	size_t b = 0;
+	while(b + 1 < BUCKETS && us >= upper_bound(b))
+		++b;
+	++_buckets[b];
+	++_count;
+	_sum += us;
+	unsigned long long seen = _max;
+	while(us > seen && !_max.compare_exchange_weak(seen, us))
+		;
+}
+
+unsigned long long latency_histogram::quantile(double q) const
+{
+	unsigned long long total = _count;
+	if(!total)
+		return 0;
+	unsigned long long rank = (unsigned long long)(q * total + 0.5);
+	if(!rank)
+		rank = 1;
+	unsigned long long seen = 0;
+	for(size_t b = 0; b < BUCKETS; ++b) {
+		seen += _buckets[b];
+		if(seen >= rank)
+			return b + 1 < BUCKETS ? upper_bound(b) : (unsigned long long)_max;
+	}
+	return _max;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+RunMetrics::RunMetrics()
+: _busy(0)
+, _workers(0)
+, _samples(0)
+, _queue_depth(0)
+, _queue_depth_max(0)
+, _queue_depth_sum(0)
+, _busy_sampled(0)
+, _busy_max(0)
+{
+	for(size_t c = 0; c < COUNTER_COUNT; ++c)
+		_counters[c] = 0;
+}
+
+void RunMetrics::Start(unsigned int workers)
+{
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	if(_start.is_not_a_date_time())
+		_start = Now();
+	_workers = workers;
+}
+
+void RunMetrics::Sample(size_t queue_depth)
+{
+	unsigned int busy = _busy;
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	++_samples;
+	_queue_depth = queue_depth;
+	_queue_depth_sum += queue_depth;
+	if(queue_depth > _queue_depth_max)
+		_queue_depth_max = queue_depth;
+	_busy_sampled = busy;
+	if(busy > _busy_max)
+		_busy_max = busy;
+}
+
+const char *RunMetrics::CounterName(Counter c)
+{
+	switch(c) {
+	case FilesSeen: return "files_seen";
+	case SkippedExtension: return "skipped_extension";
+	case RejectedPath: return "rejected_path";
+	case RejectedDelimiter: return "rejected_delimiter";
+	case RejectedFieldCount: return "rejected_field_count";
+	case RejectedExpression: return "rejected_expression";
+	case SkippedIndex: return "skipped_index";
+	case SkippedJournal: return "skipped_journal";
+	case OpenFailed: return "open_failed";
+	case RejectedNonEmpty: return "rejected_non_empty";
+	case TimedOut: return "timed_out";
+	case Unchanged: return "unchanged";
+	case Saved: return "saved";
+	case Errors: return "errors";
+	case DirectRead: return "direct_read";
+	case WrittenInPlace: return "written_in_place";
+	case WrittenRewrite: return "written_rewrite";
+	case WrittenTagLib: return "written_taglib";
+	case BytesWritten: return "bytes_written";
+	case BytesAvoided: return "bytes_avoided";
+	case Duplicates: return "duplicates";
+	case TagsPropagated: return "tags_propagated";
+	default: return "unknown";
+	}
+}
+
+const char *RunMetrics::StageName(Stage s)
+{
+	switch(s) {
+	case Traversal: return "traversal";
+	case Hash: return "hash";
+	case Match: return "match";
+	case Open: return "open";
+	case Save: return "save";
+	case File: return "file";
+	default: return "unknown";
+	}
+}
+
+void RunMetrics::Print() const
+{
+	Log << _T("Files: ") << Get(FilesSeen)
+		<< _T(", skipped by extension: ") << Get(SkippedExtension)
+		<< _T(", rejected by path: ") << Get(RejectedPath)
+		<< _T(", by delimiter: ") << Get(RejectedDelimiter)
+		<< _T(", by field count: ") << Get(RejectedFieldCount)
+		<< _T(", by expression: ") << Get(RejectedExpression)
+		<< _T(", unchanged: ") << Get(SkippedIndex)
+		<< _T(", done before interruption: ") << Get(SkippedJournal)
+		<< _T(", unreadable: ") << Get(OpenFailed)
+		<< _T(", rejected by tags: ") << Get(RejectedNonEmpty)
+		<< _T(", timed out: ") << Get(TimedOut)
+		<< _T(", already up to date: ") << Get(Unchanged)
+		<< _T(", tagged: ") << Get(Saved)
+		<< _T(", errors: ") << Get(Errors) << std::endl;
+	Log << _T("Read without TagLib: ") << Get(DirectRead)
+		<< _T(", written in place: ") << Get(WrittenInPlace)
+		<< _T(", rewritten: ") << Get(WrittenRewrite)
+		<< _T(", written by TagLib: ") << Get(WrittenTagLib) << std::endl;
+	Log << _T("Bytes written: ") << Get(BytesWritten)
+		<< _T(", in files not saved because nothing changed: ") << Get(BytesAvoided) << std::endl;
+	if(Get(Duplicates))
+		Log << _T("Duplicates: ") << Get(Duplicates)
+			<< _T(", tagged like their original: ") << Get(TagsPropagated) << std::endl;
+
+	for(size_t s = 0; s < STAGE_COUNT; ++s) {
+		const latency_histogram &h = _stages[s];
+		if(!h.count())
+			continue;
+		Log << _T("Stage ") << StageName((Stage)s) << _T(": ") << h.count()
+			<< _T(" x, mean ") << h.sum() / h.count()
+			<< _T(" us, p50 < ") << h.quantile(0.5)
+			<< _T(" us, p99 < ") << h.quantile(0.99)
+			<< _T(" us, max ") << h.max() << _T(" us") << std::endl;
+	}
+
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	if(_start.is_not_a_date_time())
+		return;
+	double wall = (Now() - _start).total_microseconds() / 1e6;
+	double busy = _stages[File].sum() / 1e6;
+	std::basic_ostringstream<char_type> line;
+	line << std::fixed << std::setprecision(2) << _T("Run: ") << wall << _T(" s, ") << _workers
+		<< _T(" workers, utilization ") << (wall > 0 && _workers ? 100 * busy / (wall * _workers) : 0.0) << _T("%");
+	if(_samples)
+		line << _T(", queue depth mean ") << (double)_queue_depth_sum / _samples
+			<< _T(" max ") << _queue_depth_max << _T(", busy workers max ") << _busy_max;
+	Log << line.str() << std::endl;
+}
+
+void RunMetrics::Write(std::ostream &out) const
+{
+	out.precision(12);				//bucket bounds are exact in microseconds
+	for(size_t c = 0; c < COUNTER_COUNT; ++c) {
+		const char *name = CounterName((Counter)c);
+		out << "# TYPE mp3tagger_" << name << "_total counter\n"
+			<< "mp3tagger_" << name << "_total " << Get((Counter)c) << "\n";
+	}
+
+	out << "# TYPE mp3tagger_stage_seconds histogram\n";
+	for(size_t s = 0; s < STAGE_COUNT; ++s) {
+		const latency_histogram &h = _stages[s];
+		const char *stage = StageName((Stage)s);
+		unsigned long long cumulative = 0;
+		for(size_t b = 0; b + 1 < latency_histogram::BUCKETS; ++b) {
+			cumulative += h.bucket(b);
+			out << "mp3tagger_stage_seconds_bucket{stage=\"" << stage << "\",le=\""
+				<< latency_histogram::upper_bound(b) / 1e6 << "\"} " << cumulative << "\n";
+		}
+		out << "mp3tagger_stage_seconds_bucket{stage=\"" << stage << "\",le=\"+Inf\"} " << h.count() << "\n"
+			<< "mp3tagger_stage_seconds_sum{stage=\"" << stage << "\"} " << h.sum() / 1e6 << "\n"
+			<< "mp3tagger_stage_seconds_count{stage=\"" << stage << "\"} " << h.count() << "\n";
+	}
+
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	double wall = _start.is_not_a_date_time() ? 0 : (Now() - _start).total_microseconds() / 1e6;
+	out << "# TYPE mp3tagger_run_seconds gauge\n"
+		<< "mp3tagger_run_seconds " << wall << "\n"
+		<< "# TYPE mp3tagger_workers gauge\n"
+		<< "mp3tagger_workers " << _workers << "\n"
+		<< "# TYPE mp3tagger_busy_workers gauge\n"
+		<< "mp3tagger_busy_workers " << _busy_sampled << "\n"
+		<< "# TYPE mp3tagger_queue_depth gauge\n"
+		<< "mp3tagger_queue_depth " << _queue_depth << "\n"
+		<< "# TYPE mp3tagger_queue_depth_max gauge\n"
+		<< "mp3tagger_queue_depth_max " << _queue_depth_max << "\n";
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+stage_timer::stage_timer(RunMetrics &metrics, RunMetrics::Stage stage)
+: _metrics(metrics)
+, _stage(stage)
+, _start(Now())
+, _running(true)
+, _paused(false)
+{
+}
+
+void stage_timer::stop()
+{
+	if(!_running)
+		return;
+	_running = false;
+	if(!_paused)
+		_elapsed += Now() - _start;
+	_metrics.Time(_stage, _elapsed.total_microseconds());
+}
+
+void stage_timer::pause()
+{
+	if(!_running || _paused)
+		return;
+	_elapsed += Now() - _start;
+	_paused = true;
+}
+
+void stage_timer::resume()
+{
+	if(!_running || !_paused)
+		return;
+	_start = Now();
+	_paused = false;
+}
@@ -0,0 +1,138 @@
+/*
+ * Metrics.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <ostream>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Latencies in microseconds, counted in power-of-two buckets:
+//bucket 0 holds 0-1 us, bucket b holds [2^(b-1), 2^b) us, the last one everything above.
+//Lock free, so every worker can add to the same histogram.
+class latency_histogram {
+public:
+	static const size_t BUCKETS = 32;			//the last finite bound is about 36 minutes
+
+	latency_histogram();
+
+	void add(unsigned long long us);
+	unsigned long long count() const { return _count; }
+	unsigned long long sum() const { return _sum; }	//us
+	unsigned long long max() const { return _max; }	//us
+	unsigned long long bucket(size_t b) const { return _buckets[b]; }
+	static unsigned long long upper_bound(size_t b) { return 1ULL << b; }	//us, exclusive
+	//Upper bound of the bucket holding the q-th quantile (0 < q <= 1)
+	unsigned long long quantile(double q) const;
+
+private:
+	boost::atomic<unsigned long long> _buckets[BUCKETS];
+	boost::atomic<unsigned long long> _count;
+	boost::atomic<unsigned long long> _sum;
+	boost::atomic<unsigned long long> _max;
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Counters, stage latencies and worker load of one run.
+//Workers update it without locks; Sample() is called periodically from one
+//thread to record the queue depth and how many workers are busy.
+//Print() writes the summary to the log, Write() the Prometheus text format.
+class RunMetrics {
+public:
+	enum Counter {
+		FilesSeen,					//entered the pipeline
+		SkippedExtension,			//not of a format a backend handles
+		RejectedPath,				//not enough parent directories for the pattern
+		RejectedDelimiter,
+		RejectedFieldCount,
+		RejectedExpression,			//name did not match a `re:` pattern
+		SkippedIndex,				//unchanged since a previous run
+		SkippedJournal,				//finished before an interrupted run stopped
+		OpenFailed,					//TagLib could not read the file
+		RejectedNonEmpty,			//--empty constraint failed
+		TimedOut,
+		Unchanged,					//tags already held the extracted values
+		Saved,
+		Errors,						//exceptions and failed saves
+		DirectRead,					//ID3v2 tag read without TagLib
+		WrittenInPlace,				//tag fit into its padding
+		WrittenRewrite,				//tag grew, the audio was moved
+		WrittenTagLib,				//saved by TagLib, either way
+		BytesWritten,				//exact for direct writes, the file size for TagLib's
+		BytesAvoided,				//file sizes of files not saved
+		Duplicates,					//same audio as a file seen before in the run
+		TagsPropagated,				//duplicates given their original's tags, without matching
+		COUNTER_COUNT
+	};
+	enum Stage {
+		Traversal,					//reading one directory
+		Hash,						//audio hash, or its lookup in the index
+		Match,						//file name against the patterns
+		Open,						//reading the tag, directly or by TagLib
+		Save,						//FileRef::save()
+		File,						//whole file, i.e. worker busy time
+		STAGE_COUNT
+	};
+
+	RunMetrics();
+
+	void Start(unsigned int workers);	//sets the run's start time once, and the worker count
+	void Add(Counter c, unsigned long long n = 1) { _counters[c] += n; }
+	unsigned long long Get(Counter c) const { return _counters[c]; }
+	void Time(Stage s, unsigned long long us) { _stages[s].add(us); }
+	const latency_histogram &Histogram(Stage s) const { return _stages[s]; }
+
+	void WorkerBusy() { ++_busy; }
+	void WorkerIdle() { --_busy; }
+	void Sample(size_t queue_depth);
+
+	void Print() const;
+	void Write(std::ostream &out) const;
+
+	static const char *CounterName(Counter c);
+	static const char *StageName(Stage s);
+
+private:
+	boost::atomic<unsigned long long> _counters[COUNTER_COUNT];
+	latency_histogram _stages[STAGE_COUNT];
+	boost::atomic<unsigned int> _busy;
+	boost::posix_time::ptime _start;
+	unsigned int _workers;
+	//Sampled, guarded by _mtx
+	mutable boost::mutex _mtx;
+	unsigned long long _samples;
+	size_t _queue_depth;
+	size_t _queue_depth_max;
+	unsigned long long _queue_depth_sum;
+	unsigned int _busy_sampled;
+	unsigned int _busy_max;
+};
+
+//Adds the time from construction to stop() (or destruction) to a stage,
+//less any time paused
+class stage_timer {
+public:
+	stage_timer(RunMetrics &metrics, RunMetrics::Stage stage);
+	~stage_timer() { stop(); }
+	void stop();
+	//Leaves out what happens in between, e.g. waiting for another stage
+	void pause();
+	void resume();
+private:
+	RunMetrics &_metrics;
+	RunMetrics::Stage _stage;
+	boost::posix_time::ptime _start;
+	boost::posix_time::time_duration _elapsed;	//before the last pause
+	bool _running;
+	bool _paused;
+};
+
+#endif /* METRICS_H_ */
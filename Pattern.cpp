@@ -0,0 +1,645 @@
+/*
+ * Pattern.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Pattern.h"
+#include "Regex.h"
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <map>
+
+tstring FieldTypeToString(FieldType type)
+{
+	tstring str_type;
+	switch(type)
+	{
+		case Title:
+			str_type = _T("Title";)
+			break;
+		case Artist:
+			str_type = _T("Artist");
+			break;
+		case Album:
+			str_type = _T("Album");
+			break;
+		case Genre:
+			str_type = _T("Genre");
+			break;
+		case Comment:
+			str_type = _T("Comment");
+			break;
+		case TrackNo:
+			str_type = _T("Track#");
+			break;
+		case Year:
+			str_type = _T("Year");
+			break;
+		case Delimiter:
+			str_type = _T("Delimiter");
+			break;
+		case Ignore:
+			str_type = _T("Ignore");
+			break;
+		default:
+			str_type = _T("_Unknown");
+			break;
+	}
+	return str_type;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+Field::Field(tstring content, FieldType type)
+: _content(content)
+, _type(type)
+{
+}
+
+Field::~Field()
+{
+}
+
+unsigned int Field::ToNumber() const
+{
+	size_t i = 0;
+	while(i < _content.size() && (_content[i] == _T(' ') || _content[i] == _T('\t')))
+		++i;
+	unsigned int value = 0;
+	for(; i < _content.size() && _content[i] >= _T('0') && _content[i] <= _T('9') && value < 100000000; ++i)
+		value = value * 10 + (_content[i] - _T('0'));
+	return value;
+}
+//////////////////////////////////////////////////////////////////////////////////
+
+Pattern::Pattern(tstring format, bool trim)
+: _pattern(format)
+, _trim(trim)
+, _max_errors(0)
+{
+	std::fill(_trim_table, _trim_table + SKIP_TABLE_SIZE, false);
+	const tstring expression = _T("re:");
+	if(_pattern.compare(0, expression.size(), expression) == 0) {
+		_regex.reset(new Regex(_pattern.substr(expression.size())));
+		_nNamedFields = _regex->field_count();
+		_nDelFields = 0;
+		_nPathSeparators = _regex->get_separator_count();
+		_valid = true;
+	} else
+		_valid = parse();
+}
+
+Pattern::~Pattern()
+{
+}
+
+//A valid pattern is:
+//A sequence of one or more known fields (<Artist> ...)
+//separated by any delimiter string
+
+bool Pattern::parse()
+{
+	_nNamedFields = 0;
+	_nDelFields = 0;
+	_nPathSeparators = 0;
+	_structure.clear();
+	_delimiters_generic.clear();
+
+	//Find all occurrences of the allowed fields
+	Field title(_T("<Title>"), Title);
+	_nNamedFields += find_in_pattern(title);
+
+	Field artist(_T("<Artist>"), Artist);
+	_nNamedFields += find_in_pattern(artist);
+
+	Field album(_T("<Album>"), Album);
+	_nNamedFields += find_in_pattern(album);
+
+	Field genre(_T("<Genre>"), Genre);
+	_nNamedFields += find_in_pattern(genre);
+
+	Field comment(_T("<Comment>"), Comment);
+	_nNamedFields += find_in_pattern(comment);
+
+	Field trackno(_T("<Track#>"), TrackNo);
+	_nNamedFields += find_in_pattern(trackno);
+
+	Field year(_T("<Year>"), Year);
+	_nNamedFields += find_in_pattern(year);
+
+	Field ignore(_T("<Ignore>"), Ignore);
+	_nNamedFields += find_in_pattern(ignore);
+
+	//Everything else must be delimiters
+	size_t prev_pos = 0;
+	size_t prev_size= 0;
+	size_t pos = 0;
+	size_t size = 0;
+	position_map::iterator it = _structure.begin();
+	for(; it != _structure.end(); ++it)
+	{
+		pos = it->first;
+		size = it->second.size();
+
+		if(!parse_helper(pos, size, prev_pos, prev_size)) {
+			throw Exc("Invalid pattern: Adjacent fields without a delimiter.");
+			return false;
+		}
+
+		//Update previous
+		prev_pos = pos;
+		prev_size = size;
+	}
+
+	bool tail = _pattern.size() > (pos + size);
+	if(tail) parse_helper(_pattern.size(), 0, pos, size);
+
+
+	_structure.insert(_delimiters_generic.begin(), _delimiters_generic.end());
+	compile();
+	return true;
+}
+
+int Pattern::find_in_pattern(Field needle)
+{
+	return find_insert_field(needle, _pattern, _structure);
+}
+
+int Pattern::find_insert_field(Field needle, tstring &haystack, position_map &out)
+{
+	int count = 0;
+
+	size_t pos = haystack.find(needle._content, 0);
+	while(pos != tstring::npos)
+	{
+		++count;
+		out.insert(std::pair<size_t,Field>(pos, needle));
+	    pos = haystack.find(needle._content,pos+1);
+	}
+	return count;
+}
+
+bool Pattern::parse_helper(size_t pos, size_t size, size_t prev_pos, size_t prev_size)
+{
+	size_t del_start = prev_pos + prev_size;
+	size_t del_end = pos;
+	if(del_end <= del_start) {
+		if(del_start ==0) {
+			//Update previous
+			prev_pos = pos;
+			prev_size = size;
+			return true;
+		}
+		return false;
+	}
+	tstring delimiter = _pattern.substr(del_start, del_end-del_start);
+	if(_trim) {
+		boost::algorithm::trim_if(delimiter, boost::is_any_of(_trim_chars));
+		if(delimiter.size() < 1)
+			return false;
+	}
+	Field del(delimiter, Delimiter);
+	_delimiters_generic.insert(std::pair<size_t,Field>(del_start, del));
+	++_nDelFields;
+	if(delimiter==_T("/") || delimiter==_T("\\"))
+		++_nPathSeparators;
+	return true;
+}
+
+//Flatten the delimiters and field order so match() only walks arrays
+void Pattern::compile()
+{
+	if(_nNamedFields > MatchResult::MAX_FIELDS)
+		throw Exc("Invalid pattern: Too many fields.");
+
+	_delimiter_chars.clear();
+	_delimiters.clear();
+	_skip.clear();
+
+	size_t n = 0;
+	for(position_map::const_iterator it = _structure.begin(); it != _structure.end(); ++it)
+	{
+		const Field &field = it->second;
+		if(field._type != Delimiter) {
+			_field_types[n++] = field._type;
+			continue;
+		}
+		delimiter_op op;
+		op.offset = _delimiter_chars.size();
+		op.length = field._content.size();
+		op.skip = _skip.size();
+		_delimiter_chars += field._content;
+
+		//Horspool shift table, indexed by the low byte of the character
+		//(wide characters that share a low byte keep the smallest, still safe, shift)
+		if(op.length > 1) {
+			_skip.resize(_skip.size() + SKIP_TABLE_SIZE, op.length);
+			size_t *table = &_skip[op.skip];
+			for(size_t i = 0; i + 1 < op.length; ++i)
+				table[(size_t)field._content[i] & 0xFF] = op.length - 1 - i;
+		}
+		_delimiters.push_back(op);
+	}
+}
+
+void Pattern::SetTrimChars(tstring chars)
+{
+	_trim_chars = chars;
+	std::fill(_trim_table, _trim_table + SKIP_TABLE_SIZE, false);
+	for(tstring::const_iterator it = _trim_chars.begin(); it != _trim_chars.end(); ++it) {
+		size_t code = std::char_traits<char_type>::to_int_type(*it);
+		if(code < SKIP_TABLE_SIZE)
+			_trim_table[code] = true;
+	}
+}
+
+void Pattern::SetTolerance(unsigned int max_errors, const std::vector<tstring> &equivalents)
+{
+	_max_errors = std::min(max_errors, (unsigned int)MAX_ERRORS);
+	_equivalents = equivalents;
+	compile_tolerance();
+}
+
+bool Pattern::is_trim_char(char_type c) const
+{
+	size_t code = std::char_traits<char_type>::to_int_type(c);
+	if(code < SKIP_TABLE_SIZE)
+		return _trim_table[code];
+	return _trim_chars.find(c) != tstring::npos;
+}
+
+size_t Pattern::find_delimiter(const delimiter_op &op, const char_type *hay, size_t size, size_t from) const
+{
+	typedef std::char_traits<char_type> traits;
+	const char_type *needle = _delimiter_chars.data() + op.offset;
+	const size_t m = op.length;
+
+	if(from + m > size)
+		return tstring::npos;
+	if(m == 1) {
+		//memchr/wmemchr
+		const char_type *hit = traits::find(hay + from, size - from, needle[0]);
+		return hit ? hit - hay : tstring::npos;
+	}
+
+	const size_t *skip = &_skip[op.skip];
+	const char_type last = needle[m-1];
+	for(size_t i = from; i + m <= size; ) {
+		char_type c = hay[i + m - 1];
+		if(c == last && traits::compare(hay + i, needle, m - 1) == 0)
+			return i;
+		i += skip[(size_t)c & 0xFF];
+	}
+	return tstring::npos;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	//Tolerance counts code points, so `–` for `-` is one edit
+	void Symbols(const char_type *s, size_t size, std::vector<unsigned int> &out)
+	{
+		out.clear();
+		for(size_t i = 0; i < size; )
+			out.push_back(NextCodePoint(s, size, i));
+	}
+}
+
+//Shift-and masks for every delimiter short enough to fit a 64-bit word
+void Pattern::compile_tolerance()
+{
+	_tolerant.clear();
+	_tolerant_masks.clear();
+	_tolerant_wide.clear();
+	if(!_max_errors && _equivalents.empty())
+		return;
+
+	std::vector<std::vector<unsigned int> > classes(_equivalents.size());
+	for(size_t c = 0; c < _equivalents.size(); ++c)
+		Symbols(_equivalents[c].data(), _equivalents[c].size(), classes[c]);
+
+	std::vector<unsigned int> symbols, stands_for;
+	for(size_t i = 0; i < _delimiters.size(); ++i) {
+		const delimiter_op &dop = _delimiters[i];
+		Symbols(_delimiter_chars.data() + dop.offset, dop.length, symbols);
+
+		tolerant_op op;
+		op.symbols = 0;
+		op.errors = 0;
+		op.masks = _tolerant_masks.size();
+		op.wide_begin = op.wide_end = _tolerant_wide.size();
+		if(symbols.size() > MAX_TOLERANT_SYMBOLS) {
+			_tolerant.push_back(op);
+			continue;
+		}
+		//At least half of the delimiter has to be there, or a short one
+		//would be found between any two characters
+		op.symbols = symbols.size();
+		op.errors = std::min((size_t)_max_errors, op.symbols / 2);
+		_tolerant_masks.resize(op.masks + 2 * SKIP_TABLE_SIZE, 0);
+
+		std::map<unsigned int, std::pair<unsigned long long, unsigned long long> > wide;
+		for(size_t j = 0; j < op.symbols; ++j) {
+			stands_for.assign(1, symbols[j]);
+			for(size_t c = 0; c < classes.size(); ++c)
+				if(std::find(classes[c].begin(), classes[c].end(), symbols[j]) != classes[c].end())
+					stands_for.insert(stands_for.end(), classes[c].begin(), classes[c].end());
+
+			unsigned long long forward = 1ULL << j, backward = 1ULL << (op.symbols - 1 - j);
+			for(size_t s = 0; s < stands_for.size(); ++s) {
+				unsigned int code = stands_for[s];
+				if(code < SKIP_TABLE_SIZE) {
+					_tolerant_masks[op.masks + code] |= forward;
+					_tolerant_masks[op.masks + SKIP_TABLE_SIZE + code] |= backward;
+				} else {
+					wide[code].first |= forward;
+					wide[code].second |= backward;
+				}
+			}
+		}
+		for(std::map<unsigned int, std::pair<unsigned long long, unsigned long long> >::const_iterator it = wide.begin(); it != wide.end(); ++it) {
+			wide_mask w;
+			w.code = it->first;
+			w.forward = it->second.first;
+			w.backward = it->second.second;
+			_tolerant_wide.push_back(w);
+		}
+		op.wide_end = _tolerant_wide.size();
+		_tolerant.push_back(op);
+	}
+}
+
+unsigned long long Pattern::tolerant_mask(const tolerant_op &op, unsigned int code, bool backward) const
+{
+	if(code < SKIP_TABLE_SIZE)
+		return _tolerant_masks[op.masks + (backward ? SKIP_TABLE_SIZE : 0) + code];
+	wide_mask key;
+	key.code = code;
+	std::vector<wide_mask>::const_iterator begin = _tolerant_wide.begin() + op.wide_begin;
+	std::vector<wide_mask>::const_iterator end = _tolerant_wide.begin() + op.wide_end;
+	std::vector<wide_mask>::const_iterator it = std::lower_bound(begin, end, key);
+	if(it == end || it->code != code)
+		return 0;
+	return backward ? it->backward : it->forward;
+}
+
+//Bit-parallel approximate search (Wu-Manber): bit j of R[d] says the first
+//j+1 delimiter symbols match the text up to here with at most d edits.
+//The first end found is improved on for up to k more symbols, then the
+//start is found the same way, running backward from the end.
+size_t Pattern::find_tolerant(size_t delimiter, const char_type *hay, size_t size, size_t from, size_t &end) const
+{
+	const tolerant_op &op = _tolerant[delimiter];
+	if(!op.symbols)
+		return tstring::npos;
+	const size_t k = op.errors;
+	const unsigned long long accept = 1ULL << (op.symbols - 1);
+	unsigned long long R[MAX_ERRORS + 1];
+
+	for(size_t d = 0; d <= k; ++d)
+		R[d] = (1ULL << d) - 1;
+	size_t best_end = tstring::npos, best = k + 1, lookahead = k;
+	for(size_t i = from; i < size && best > 0; ) {
+		unsigned long long mask = tolerant_mask(op, NextCodePoint(hay, size, i), false);
+		unsigned long long prev = R[0];
+		R[0] = ((R[0] << 1) | 1) & mask;
+		for(size_t d = 1; d <= k; ++d) {
+			unsigned long long cur = R[d];
+			//match, substitution, insertion, deletion
+			R[d] = (((cur << 1) | 1) & mask) | ((prev << 1) | 1) | prev | (R[d-1] << 1);
+			prev = cur;
+		}
+		for(size_t d = 0; d < best; ++d)
+			if(R[d] & accept) {
+				best = d;
+				best_end = i;
+				break;
+			}
+		if(best_end != tstring::npos && lookahead-- == 0)
+			break;
+	}
+	if(best_end == tstring::npos)
+		return tstring::npos;
+
+	for(size_t d = 0; d <= best; ++d)
+		R[d] = (1ULL << d) - 1;
+	for(size_t i = best_end; i > from; ) {
+		unsigned long long mask = tolerant_mask(op, PrevCodePoint(hay, from, i), true);
+		unsigned long long prev = R[0];
+		R[0] = ((R[0] << 1) | 1) & mask;
+		for(size_t d = 1; d <= best; ++d) {
+			unsigned long long cur = R[d];
+			R[d] = (((cur << 1) | 1) & mask) | ((prev << 1) | 1) | prev | (R[d-1] << 1);
+			prev = cur;
+		}
+		if(R[best] & accept) {
+			end = best_end;
+			return i;
+		}
+	}
+	return tstring::npos;
+}
+
+//Searches the name directly with the per-delimiter shift tables
+struct Pattern::search_locator {
+	const Pattern &pattern;
+	const char_type *str;
+	size_t size;
+
+	search_locator(const Pattern &p, const char_type *s, size_t n) : pattern(p), str(s), size(n) {}
+	size_t find(size_t delimiter, size_t from) const {
+		return pattern.find_delimiter(pattern._delimiters[delimiter], str, size, from);
+	}
+};
+
+bool Pattern::match(const tstring &file_str, MatchResult &out) const
+{
+	return match(file_str.data(), file_str.size(), out);
+}
+
+bool Pattern::match(const char_type *file_str, size_t size, MatchResult &out) const
+{
+	return match_with(file_str, size, search_locator(*this, file_str, size), out);
+}
+
+bool Pattern::match(const char_type *file_str, size_t size, const DelimiterLocator &locator, MatchResult &out) const
+{
+	return match_with(file_str, size, locator, out);
+}
+
+template <class Locator>
+bool Pattern::match_with(const char_type *file_str, size_t size, const Locator &locator, MatchResult &out) const
+{
+	out.count = 0;
+	out.status = MatchOk;
+
+	if(_regex) {
+		if(!_regex->match(file_str, size, out)) {
+			out.status = MatchNoExpression;
+			return false;
+		}
+		trim_fields(file_str, out);
+		return true;
+	}
+
+	//Delimiters must appear in order; whatever is between them is a field
+	size_t field_start = 0;
+	for(size_t i = 0; i < _delimiters.size(); ++i)
+	{
+		size_t pos = locator.find(i, field_start);
+		size_t end = pos + _delimiters[i].length;
+		if(pos == tstring::npos && !_tolerant.empty())
+			pos = find_tolerant(i, file_str, size, field_start, end);
+		if(pos == tstring::npos) {
+			out.status = MatchNoDelimiter;
+			out.failed_delimiter = i;
+			return false;
+		}
+		if(pos > field_start) {
+			if(out.count == _nNamedFields) {
+				out.status = MatchFieldCount;
+				return false;
+			}
+			FieldSpan &span = out.fields[out.count];
+			span.type = _field_types[out.count];
+			span.begin = field_start;
+			span.end = pos;
+			++out.count;
+		}
+		field_start = end;
+	}
+	//check tail
+	if(field_start != size) {
+		if(out.count == _nNamedFields) {
+			out.status = MatchFieldCount;
+			return false;
+		}
+		FieldSpan &span = out.fields[out.count];
+		span.type = _field_types[out.count];
+		span.begin = field_start;
+		span.end = size;
+		++out.count;
+	}
+
+	if(_nNamedFields != out.count) {
+		out.status = MatchFieldCount;
+		return false;
+	}
+
+	trim_fields(file_str, out);
+	return true;
+}
+
+void Pattern::trim_fields(const char_type *file_str, MatchResult &out) const
+{
+	if(!_trim)
+		return;
+	for(size_t i = 0; i < out.count; ++i) {
+		FieldSpan &span = out.fields[i];
+		while(span.begin < span.end && is_trim_char(file_str[span.begin]))
+			++span.begin;
+		while(span.end > span.begin && is_trim_char(file_str[span.end - 1]))
+			--span.end;
+	}
+}
+
+size_t Pattern::match_batch(const char_type *buffer, size_t size, BatchResult &out) const
+{
+	out.clear();
+	out.field_count = _nNamedFields;
+
+	MatchResult result;
+	size_t line_start = 0;
+	while(line_start < size) {
+		const char_type *eol = std::char_traits<char_type>::find(buffer + line_start, size - line_start, _T('\n'));
+		size_t line_end = eol ? eol - buffer : size;
+		size_t next = eol ? line_end + 1 : size;
+		if(line_end > line_start && buffer[line_end - 1] == _T('\r'))
+			--line_end;
+		if(line_end == line_start) {	//blank line
+			line_start = next;
+			continue;
+		}
+
+		bool ok = match(buffer + line_start, line_end - line_start, result);
+		out.name_begin.push_back(line_start);
+		out.name_end.push_back(line_end);
+		out.status.push_back((unsigned char)result.status);
+		//Every name gets field_count slots; unmatched names leave them empty
+		for(size_t i = 0; i < _nNamedFields; ++i) {
+			bool has = ok && i < result.count;
+			out.field_begin.push_back(has ? line_start + result.fields[i].begin : line_start);
+			out.field_end.push_back(has ? line_start + result.fields[i].end : line_start);
+		}
+		if(ok)
+			++out.matched;
+		line_start = next;
+	}
+	return out.matched;
+}
+
+tstring Pattern::delimiter(size_t index) const
+{
+	const delimiter_op &op = _delimiters.at(index);
+	return _delimiter_chars.substr(op.offset, op.length);
+}
+
+void Pattern::print() const
+{
+	if(!_valid) {
+		LogError << _T("Pattern::print(): Invalid pattern") << std::endl;
+		return;
+	}
+	Log << _T("Trim=") << _trim << std::endl;
+	if(_regex) {
+		LogType mylog;
+		mylog << _T("Expression `") << _pattern.substr(3) << _T("`, fields");
+		for(size_t i = 0; i < _regex->field_count(); ++i)
+			mylog << _T(" ") << FieldTypeToString(_regex->field_type(i));
+		mylog << std::endl;
+		return;
+	}
+	if(!_tolerant.empty()) {
+		LogType mylog;
+		mylog << _T("Tolerance: ") << _max_errors << _T(" edits");
+		for(std::vector<tstring>::const_iterator it = _equivalents.begin(); it != _equivalents.end(); ++it)
+			mylog << _T(", `") << *it << _T("`");
+		mylog << std::endl;
+	}
+	
+	for(position_map::const_iterator it = _structure.begin(); it != _structure.end(); ++it)
+	{
+		LogType mylog;
+		size_t pos = it->first;
+		const Field &field = it->second;
+		mylog << _T("Type ") << FieldTypeToString(field._type);
+		if(field._type == Delimiter)
+			mylog << _T("`") << field._content << _T("`");
+		mylog << _T(" at pos= ") << pos << std::endl;
+	}
+
+}
+
+bool Pattern::begins_with_separator() const
+{
+	if(_regex)
+		return _regex->begins_with_separator();
+	if(!_structure.empty() &&
+			_structure.begin()->second._type == Delimiter &&
+			(_structure.begin()->second._content == _T("/") ||
+					_structure.begin()->second._content == _T("\\")))
+		return true;
+	return false;
+}
+
+unsigned long long Pattern::hash(unsigned long long seed) const
+{
+	seed = HashBytes(_pattern.data(), _pattern.size() * sizeof(char_type), seed);
+	seed = HashBytes(&_trim, sizeof(_trim), seed);
+	seed = HashBytes(_trim_chars.data(), _trim_chars.size() * sizeof(char_type), seed);
+	seed = HashBytes(&_max_errors, sizeof(_max_errors), seed);
+	for(std::vector<tstring>::const_iterator it = _equivalents.begin(); it != _equivalents.end(); ++it)
+		seed = HashBytes(it->c_str(), (it->size() + 1) * sizeof(char_type), seed);
+	return seed;
+}
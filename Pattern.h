@@ -0,0 +1,197 @@
+/*
+ * Pattern.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef PATTERN_H_
+#define PATTERN_H_
+
+#include <map>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include "common.h"
+
+class Regex;
+
+
+//////////////////////////////////////////////////////////////////////////////////
+
+enum FieldType {Title = 0, Artist, Album, TrackNo, Genre,
+				Year, Comment, Ignore, Delimiter, _Unknown};
+
+tstring FieldTypeToString(FieldType type);
+
+//////////////////////////////////////////////////////////////////////////////////
+
+class Field {
+private:
+	Field(): _type(_Unknown) {}
+public:
+	Field(tstring content, FieldType type);
+	virtual ~Field();
+public:
+	tstring _content;
+	FieldType _type;
+	size_t size() { return _content.size(); }
+
+	//Leading digits after any spaces, like atoi, read without narrowing
+	unsigned int ToNumber() const;
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//A field found in a file name, as offsets into the matched string
+struct FieldSpan {
+	FieldType type;
+	size_t begin;
+	size_t end;
+	size_t size() const { return end - begin; }
+};
+
+enum MatchStatus {MatchOk = 0, MatchNoDelimiter, MatchFieldCount, MatchNoExpression};
+
+//Filled by Pattern::match. Owned by the caller and never allocates,
+//so one instance can be reused for every file a worker handles.
+struct MatchResult {
+	enum { MAX_FIELDS = 32 };
+
+	FieldSpan fields[MAX_FIELDS];
+	size_t count;
+	MatchStatus status;
+	size_t failed_delimiter;		//index of the missing delimiter for MatchNoDelimiter
+};
+
+//Results of Pattern::match_batch, one column per property.
+//Row i describes the i-th non-blank line; its fields are the field_count
+//entries starting at i*field_count. All offsets point into the batch buffer.
+//clear() keeps the capacity, so reusing one instance avoids reallocating.
+struct BatchResult {
+	std::vector<size_t> name_begin;
+	std::vector<size_t> name_end;
+	std::vector<unsigned char> status;		//MatchStatus
+	std::vector<size_t> field_begin;
+	std::vector<size_t> field_end;
+	size_t field_count;
+	size_t matched;
+
+	BatchResult() : field_count(0), matched(0) {}
+	size_t size() const { return status.size(); }
+	void clear() {
+		name_begin.clear(); name_end.clear(); status.clear();
+		field_begin.clear(); field_end.clear();
+		field_count = 0; matched = 0;
+	}
+};
+
+//Supplies delimiter positions found by some other means (see PatternSet).
+//find() returns the first occurrence of the pattern's delimiter-th delimiter
+//starting at or after from, or tstring::npos.
+class DelimiterLocator {
+public:
+	virtual ~DelimiterLocator() {}
+	virtual size_t find(size_t delimiter, size_t from) const = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//A format like `<Artist> - <Title>`, or an expression when it starts with
+//`re:`, e.g. `re:(?<Track#>\d{1,3})\. <Artist> - <Title>( \(feat\. .*\))?`
+//(see Regex)
+class Pattern {
+public:
+	typedef std::map<size_t, Field> position_map;
+
+	Pattern(tstring format, bool trim);
+	~Pattern();
+protected:
+	position_map _structure;
+	position_map _delimiters_generic;
+
+	tstring _pattern;
+	bool _valid;
+	bool _trim;
+	tstring _trim_chars;
+
+	size_t _nNamedFields;
+	size_t _nDelFields;
+	size_t _nPathSeparators;
+
+	//Compiled form of _structure, built once by parse() and read-only afterwards
+	struct delimiter_op {
+		size_t offset;				//into _delimiter_chars
+		size_t length;
+		size_t skip;				//first of the 256 Horspool shifts in _skip, multi-char delimiters only
+	};
+	enum { SKIP_TABLE_SIZE = 256 };
+	tstring _delimiter_chars;		//all delimiters back to back, in pattern order
+	std::vector<delimiter_op> _delimiters;
+	std::vector<size_t> _skip;
+	FieldType _field_types[MatchResult::MAX_FIELDS];
+	bool _trim_table[SKIP_TABLE_SIZE];
+
+	//Tolerant form of each delimiter, built by SetTolerance: bit masks of the
+	//delimiter symbols every code point may stand for, forward and reversed
+	enum { MAX_ERRORS = 3, MAX_TOLERANT_SYMBOLS = 64 };
+	struct tolerant_op {
+		size_t symbols;				//length in code points, 0 if the delimiter is too long
+		size_t errors;
+		size_t masks;				//first of 2 * 256 masks in _tolerant_masks, forward then reversed
+		size_t wide_begin;			//its code points above 255 in _tolerant_wide
+		size_t wide_end;
+	};
+	struct wide_mask {
+		unsigned int code;
+		unsigned long long forward;
+		unsigned long long backward;
+		bool operator<(const wide_mask &other) const { return code < other.code; }
+	};
+	unsigned int _max_errors;
+	std::vector<tstring> _equivalents;
+	std::vector<tolerant_op> _tolerant;		//empty unless tolerance is on
+	std::vector<unsigned long long> _tolerant_masks;
+	std::vector<wide_mask> _tolerant_wide;
+
+	boost::scoped_ptr<Regex> _regex;		//for `re:` patterns, which have no delimiters
+
+	bool parse();
+	bool parse_helper(size_t pos, size_t size, size_t prev_pos, size_t prev_size);
+	int find_in_pattern(Field needle);
+	void compile();
+	size_t find_delimiter(const delimiter_op &op, const char_type *haystack, size_t size, size_t from) const;
+	bool is_trim_char(char_type c) const;
+	void trim_fields(const char_type *file_stem, MatchResult &out) const;
+	void compile_tolerance();
+	unsigned long long tolerant_mask(const tolerant_op &op, unsigned int code, bool backward) const;
+	size_t find_tolerant(size_t delimiter, const char_type *haystack, size_t size, size_t from, size_t &end) const;
+	struct search_locator;
+	template <class Locator>
+	bool match_with(const char_type *file_stem, size_t size, const Locator &locator, MatchResult &out) const;
+
+public:
+	bool match(const tstring &file_stem, MatchResult &out) const;
+	bool match(const char_type *file_stem, size_t size, MatchResult &out) const;
+	bool match(const char_type *file_stem, size_t size, const DelimiterLocator &locator, MatchResult &out) const;
+	//Matches every line of a newline separated buffer (blank lines are skipped).
+	//Returns the number of names that matched.
+	size_t match_batch(const char_type *buffer, size_t size, BatchResult &out) const;
+	void print() const;
+	static int find_insert_field(Field needle, tstring &haystack, position_map &out);
+
+	size_t get_separator_count() const { return _nPathSeparators; }
+	size_t get_field_count() const { return _nNamedFields; }
+	size_t get_delimiter_count() const { return _delimiters.size(); }
+	bool begins_with_separator() const;
+	void SetTrimChars(tstring chars);
+	//Accept a delimiter that is not in the name verbatim if it is there with
+	//up to max_errors edits (at most 3, and at most half of the delimiter),
+	//or with characters of one of the equivalent sets in place of each other.
+	//Only tried when the exact delimiter is missing, so names that match
+	//exactly cost nothing more.
+	void SetTolerance(unsigned int max_errors, const std::vector<tstring> &equivalents);
+	tstring delimiter(size_t index) const;
+	//Changes whenever the pattern would split names differently
+	unsigned long long hash(unsigned long long seed) const;
+};
+
+#endif /* PATTERN_H_ */
@@ -0,0 +1,191 @@
+/*
+ * PatternSet.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "PatternSet.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+
+//Answers Pattern::match's delimiter lookups from the hits of a Scan
+class occurrence_locator : public DelimiterLocator {
+public:
+	occurrence_locator(const PatternSet::Scratch &scratch, const std::vector<size_t> &ids)
+	: _scratch(scratch), _ids(ids) {}
+
+	size_t find(size_t delimiter, size_t from) const
+	{
+		size_t id = _ids[delimiter];
+		std::vector<size_t>::const_iterator begin = _scratch.positions.begin() + _scratch.first[id];
+		std::vector<size_t>::const_iterator end = _scratch.positions.begin() + _scratch.first[id+1];
+		std::vector<size_t>::const_iterator it = std::lower_bound(begin, end, from);
+		return it == end ? tstring::npos : *it;
+	}
+private:
+	const PatternSet::Scratch &_scratch;
+	const std::vector<size_t> &_ids;
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+
+PatternSet::PatternSet()
+: _columns(1)
+{
+	Compile();
+}
+
+PatternSet::~PatternSet()
+{
+}
+
+Pattern &PatternSet::Add(Pattern *p)
+{
+	_patterns.push_back(p);
+	return *p;
+}
+
+void PatternSet::Compile()
+{
+	//Number every distinct delimiter, group patterns by the name they need
+	std::map<tstring, size_t> ids;
+	std::map<std::pair<size_t, bool>, size_t> groups;
+	_delimiters.clear();
+	_delimiter_ids.assign(_patterns.size(), std::vector<size_t>());
+	_groups.clear();
+	for(size_t i = 0; i < _patterns.size(); ++i) {
+		const Pattern &p = _patterns[i];
+		for(size_t d = 0; d < p.get_delimiter_count(); ++d) {
+			tstring delimiter = p.delimiter(d);
+			std::map<tstring, size_t>::iterator it = ids.find(delimiter);
+			if(it == ids.end()) {
+				it = ids.insert(std::make_pair(delimiter, _delimiters.size())).first;
+				_delimiters.push_back(delimiter);
+			}
+			_delimiter_ids[i].push_back(it->second);
+		}
+		std::pair<size_t, bool> key(p.get_separator_count(), p.begins_with_separator());
+		std::map<std::pair<size_t, bool>, size_t>::iterator g = groups.find(key);
+		if(g == groups.end())
+			g = groups.insert(std::make_pair(key, groups.size())).first;
+		_groups.push_back(g->second);
+	}
+
+	//Alphabet: one column per character used in a delimiter
+	_byte_columns.assign(256, 0);
+	_wide_columns.clear();
+	_columns = 1;
+	for(size_t id = 0; id < _delimiters.size(); ++id) {
+		for(tstring::const_iterator c = _delimiters[id].begin(); c != _delimiters[id].end(); ++c) {
+			if(column(*c))
+				continue;
+			size_t code = std::char_traits<char_type>::to_int_type(*c);
+			if(code < 256)
+				_byte_columns[code] = _columns++;
+			else {
+				_wide_columns.push_back(std::make_pair(*c, _columns++));
+				std::sort(_wide_columns.begin(), _wide_columns.end());
+			}
+		}
+	}
+
+	//Trie of all delimiters; 0 is the root and never a child
+	std::vector<unsigned int> trie(_columns, 0);
+	std::vector<std::vector<size_t> > outputs(1);
+	for(size_t id = 0; id < _delimiters.size(); ++id) {
+		unsigned int state = 0;
+		for(tstring::const_iterator c = _delimiters[id].begin(); c != _delimiters[id].end(); ++c) {
+			unsigned int &next = trie[state * _columns + column(*c)];
+			if(!next) {
+				next = (unsigned int)outputs.size();
+				outputs.push_back(std::vector<size_t>());
+				trie.resize(outputs.size() * _columns, 0);
+			}
+			state = trie[state * _columns + column(*c)];
+		}
+		outputs[state].push_back(id);
+	}
+
+	//Breadth first: failure links, then the full transition table
+	const size_t states = outputs.size();
+	std::vector<unsigned int> fail(states, 0);
+	_delta.assign(states * _columns, 0);
+	std::deque<unsigned int> queue;
+	for(size_t c = 0; c < _columns; ++c) {
+		unsigned int child = trie[c];
+		_delta[c] = child;
+		if(child)
+			queue.push_back(child);
+	}
+	while(!queue.empty()) {
+		unsigned int state = queue.front();
+		queue.pop_front();
+		//Shorter delimiters that end here too (fail[state] is already complete)
+		const std::vector<size_t> &inherited = outputs[fail[state]];
+		outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+		for(size_t c = 0; c < _columns; ++c) {
+			unsigned int child = trie[state * _columns + c];
+			unsigned int fallback = _delta[fail[state] * _columns + c];
+			if(child) {
+				fail[child] = fallback;
+				_delta[state * _columns + c] = child;
+				queue.push_back(child);
+			} else {
+				_delta[state * _columns + c] = fallback;
+			}
+		}
+	}
+
+	_out_first.clear();
+	_out_ids.clear();
+	for(size_t state = 0; state < states; ++state) {
+		_out_first.push_back(_out_ids.size());
+		_out_ids.insert(_out_ids.end(), outputs[state].begin(), outputs[state].end());
+	}
+	_out_first.push_back(_out_ids.size());
+}
+
+size_t PatternSet::column(char_type c) const
+{
+	size_t code = std::char_traits<char_type>::to_int_type(c);
+	if(code < 256)
+		return _byte_columns[code];
+	std::vector<std::pair<char_type, size_t> >::const_iterator it =
+			std::lower_bound(_wide_columns.begin(), _wide_columns.end(), std::make_pair(c, (size_t)0));
+	return (it != _wide_columns.end() && it->first == c) ? it->second : 0;
+}
+
+void PatternSet::Scan(const char_type *name, size_t size, Scratch &scratch) const
+{
+	scratch.hits.clear();
+	unsigned int state = 0;
+	for(size_t i = 0; i < size; ++i) {
+		state = _delta[state * _columns + column(name[i])];
+		for(size_t o = _out_first[state]; o < _out_first[state+1]; ++o) {
+			size_t id = _out_ids[o];
+			scratch.hits.push_back(std::make_pair(i + 1 - _delimiters[id].size(), id));
+		}
+	}
+
+	//Counting sort by delimiter id; hits of one id stay in ascending order
+	const size_t nIds = _delimiters.size();
+	scratch.first.assign(nIds + 1, 0);
+	for(size_t h = 0; h < scratch.hits.size(); ++h)
+		++scratch.first[scratch.hits[h].second + 1];
+	for(size_t id = 0; id < nIds; ++id)
+		scratch.first[id+1] += scratch.first[id];
+	scratch.positions.resize(scratch.hits.size());
+	for(size_t h = 0; h < scratch.hits.size(); ++h)
+		scratch.positions[scratch.first[scratch.hits[h].second]++] = scratch.hits[h].first;
+	//first[id] now points one past its bucket; shift back
+	for(size_t id = nIds; id > 0; --id)
+		scratch.first[id] = scratch.first[id-1];
+	scratch.first[0] = 0;
+}
+
+bool PatternSet::Match(size_t pattern, const char_type *name, size_t size, const Scratch &scratch, MatchResult &out) const
+{
+	occurrence_locator locator(scratch, _delimiter_ids[pattern]);
+	return _patterns[pattern].match(name, size, locator, out);
+}
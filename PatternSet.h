@@ -0,0 +1,63 @@
+/*
+ * PatternSet.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef PATTERNSET_H_
+#define PATTERNSET_H_
+
+#include <vector>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include "Pattern.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//An ordered list of patterns, tried by priority until one matches.
+//Compile() builds one Aho-Corasick automaton over the delimiters of every
+//pattern, so a name is scanned once no matter how many patterns are tried.
+//Patterns that need the same number of parent directories in front of the
+//file name share a group; a name is extracted and scanned once per group.
+class PatternSet {
+public:
+	//Per-thread working memory for Scan/Match; reusing it avoids reallocating
+	struct Scratch {
+		std::vector<std::pair<size_t, size_t> > hits;	//(start, delimiter id) in scan order
+		std::vector<size_t> positions;				//hit starts, grouped by delimiter id
+		std::vector<size_t> first;					//delimiter id -> first index in positions
+	};
+
+	PatternSet();
+	~PatternSet();
+
+	Pattern &Add(Pattern *p);		//takes ownership, lowest priority so far
+	void Compile();
+
+	size_t size() const { return _patterns.size(); }
+	const Pattern &operator[](size_t i) const { return _patterns[i]; }
+	size_t group(size_t pattern) const { return _groups[pattern]; }
+
+	//Finds every delimiter of every pattern in name
+	void Scan(const char_type *name, size_t size, Scratch &scratch) const;
+	//Matches one pattern against the name last passed to Scan
+	bool Match(size_t pattern, const char_type *name, size_t size, const Scratch &scratch, MatchResult &out) const;
+
+protected:
+	size_t column(char_type c) const;
+
+protected:
+	boost::ptr_vector<Pattern> _patterns;
+	std::vector<size_t> _groups;					//pattern -> group
+	std::vector<std::vector<size_t> > _delimiter_ids;	//pattern -> its delimiters' ids
+	std::vector<tstring> _delimiters;				//id -> delimiter string
+	//Automaton: a full transition table over the characters that occur in
+	//any delimiter (column 0 stands for every other character)
+	size_t _columns;
+	std::vector<size_t> _byte_columns;				//characters below 256
+	std::vector<std::pair<char_type, size_t> > _wide_columns;	//sorted, wide characters only
+	std::vector<unsigned int> _delta;				//state * _columns + column -> state
+	std::vector<size_t> _out_first;					//state -> first in _out_ids (one extra at the end)
+	std::vector<size_t> _out_ids;					//delimiter ids ending in each state
+};
+
+#endif /* PATTERNSET_H_ */
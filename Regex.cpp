@@ -0,0 +1,550 @@
+/*
+ * Regex.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Regex.h"
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	const size_t UNBOUNDED = (size_t)-1;
+
+	//Parse tree of an expression, only kept until it is compiled
+	struct node {
+		enum Kind {Literal, Any, Class, Concat, Alternate, Repeat, Capture} kind;
+		unsigned int value;			//code point, class or capture
+		size_t min;					//Repeat
+		size_t max;					//Repeat, UNBOUNDED for no limit
+		bool lazy;
+		std::vector<size_t> children;
+
+		explicit node(Kind k, unsigned int v = 0) : kind(k), value(v), min(0), max(0), lazy(false) {}
+	};
+
+	bool IsFieldName(const std::vector<unsigned int> &name, FieldType &type)
+	{
+		for(int t = Title; t <= Ignore; ++t) {
+			tstring candidate = FieldTypeToString((FieldType)t);
+			if(candidate.size() != name.size())
+				continue;
+			size_t k = 0;
+			while(k < name.size() && name[k] == (unsigned int)std::char_traits<char_type>::to_int_type(candidate[k]))
+				++k;
+			if(k == name.size()) {
+				type = (FieldType)t;
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+void Regex::char_class::add(unsigned int first, unsigned int last)
+{
+	for(; first <= last && first < 128; ++first)
+		ascii[first >> 6] |= 1ULL << (first & 63);
+	if(first <= last)
+		ranges.push_back(std::make_pair(first, last));
+}
+
+bool Regex::char_class::contains(unsigned int c) const
+{
+	bool in = false;
+	if(c < 128)
+		in = ((ascii[c >> 6] >> (c & 63)) & 1) != 0;
+	else
+		for(size_t i = 0; i < ranges.size() && !in; ++i)
+			in = c >= ranges[i].first && c <= ranges[i].second;
+	return in != negated;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Recursive descent over the code points of the expression, then a walk of
+//the tree that emits the program
+struct Regex::parser {
+	Regex &re;
+	std::vector<unsigned int> s;
+	size_t i;
+	std::vector<node> nodes;
+
+	parser(Regex &r, const tstring &expression) : re(r), i(0)
+	{
+		for(size_t k = 0; k < expression.size(); )
+			s.push_back(NextCodePoint(expression.data(), expression.size(), k));
+	}
+
+	bool more() const { return i < s.size(); }
+	bool peek(unsigned int c) const { return i < s.size() && s[i] == c; }
+	void fail(const char *what) const { throw Exc(std::string("Invalid expression: ") + what + "."); }
+	size_t add(const node &n) { nodes.push_back(n); return nodes.size() - 1; }
+
+	size_t alternation()
+	{
+		size_t first = concatenation();
+		if(!peek('|'))
+			return first;
+		node alternate(node::Alternate);
+		alternate.children.push_back(first);
+		while(peek('|')) {
+			++i;
+			alternate.children.push_back(concatenation());
+		}
+		return add(alternate);
+	}
+
+	size_t concatenation()
+	{
+		node concat(node::Concat);
+		while(more() && !peek('|') && !peek(')'))
+			concat.children.push_back(repetition());
+		return add(concat);
+	}
+
+	size_t repetition()
+	{
+		size_t repeated = atom();
+		for(;;) {
+			size_t min, max;
+			if(peek('*')) {
+				min = 0; max = UNBOUNDED; ++i;
+			} else if(peek('+')) {
+				min = 1; max = UNBOUNDED; ++i;
+			} else if(peek('?')) {
+				min = 0; max = 1; ++i;
+			} else if(!braces(min, max))
+				return repeated;
+			node repeat(node::Repeat);
+			repeat.min = min;
+			repeat.max = max;
+			repeat.children.push_back(repeated);
+			if(peek('?')) {
+				repeat.lazy = true;
+				++i;
+			}
+			repeated = add(repeat);
+		}
+	}
+
+	//{n}, {n,} or {n,m}; anything else leaves the `{` a literal
+	bool braces(size_t &min, size_t &max)
+	{
+		if(!peek('{'))
+			return false;
+		size_t k = i + 1;
+		if(!number(k, min))
+			return false;
+		max = min;
+		if(k < s.size() && s[k] == ',') {
+			++k;
+			if(k < s.size() && s[k] == '}')
+				max = UNBOUNDED;
+			else if(!number(k, max))
+				return false;
+		}
+		if(k >= s.size() || s[k] != '}')
+			return false;
+		if(max < min)
+			fail("Repeat range out of order");
+		i = k + 1;
+		return true;
+	}
+
+	bool number(size_t &k, size_t &out)
+	{
+		size_t start = k;
+		out = 0;
+		for(; k < s.size() && s[k] >= '0' && s[k] <= '9'; ++k) {
+			out = out * 10 + (s[k] - '0');
+			if(out > MAX_REPEAT)
+				fail("Repeat count above 255");
+		}
+		return k > start;
+	}
+
+	size_t atom()
+	{
+		unsigned int c = s[i++];
+		switch(c) {
+		case '.':
+			return add(node(node::Any));
+		case '[':
+			return add(node(node::Class, char_set()));
+		case '(':
+			return group();
+		case '<':
+			return field();
+		case '\\':
+			return escape();
+		case '*':
+		case '+':
+		case '?':
+			fail("Nothing to repeat");
+		}
+		return literal(c);
+	}
+
+	size_t literal(unsigned int c)
+	{
+		if(c == '/' || c == '\\')
+			++re._nPathSeparators;
+		return add(node(node::Literal, c));
+	}
+
+	size_t escape()
+	{
+		if(!more())
+			fail("Trailing backslash");
+		unsigned int c = s[i++];
+		switch(c) {
+		case 'd': case 'w': case 's':
+		case 'D': case 'W': case 'S': {
+			char_class set;
+			shorthand(set, c | 0x20);
+			set.negated = c < 'a';
+			re._classes.push_back(set);
+			return add(node(node::Class, (unsigned int)re._classes.size() - 1));
+		}
+		case 't':
+			return literal('\t');
+		}
+		return literal(c);
+	}
+
+	static void shorthand(char_class &set, unsigned int c)
+	{
+		if(c == 'd')
+			set.add('0', '9');
+		else if(c == 'w') {
+			set.add('0', '9');
+			set.add('A', 'Z');
+			set.add('a', 'z');
+			set.add('_', '_');
+		} else {
+			set.add(' ', ' ');
+			set.add('\t', '\r');
+		}
+	}
+
+	unsigned int char_set()
+	{
+		char_class set;
+		if(peek('^')) {
+			set.negated = true;
+			++i;
+		}
+		//A ] right after the opening bracket is a member
+		for(bool first = true; more() && (first || !peek(']')); first = false) {
+			unsigned int low = s[i++];
+			if(low == '\\') {
+				if(!more())
+					fail("Trailing backslash");
+				low = s[i++];
+				if(low == 'd' || low == 'w' || low == 's') {
+					shorthand(set, low);
+					continue;
+				}
+				if(low == 'D' || low == 'W' || low == 'S')
+					fail("Negated shorthand inside [...]");
+				if(low == 't')
+					low = '\t';
+			}
+			unsigned int high = low;
+			if(peek('-') && i + 1 < s.size() && s[i+1] != ']') {
+				++i;
+				high = s[i++];
+				if(high == '\\') {
+					if(!more())
+						fail("Trailing backslash");
+					high = s[i++];
+					if(high == 't')
+						high = '\t';
+				}
+				if(high < low)
+					fail("Character range out of order");
+			}
+			set.add(low, high);
+		}
+		if(!peek(']'))
+			fail("Missing ]");
+		++i;
+		re._classes.push_back(set);
+		return (unsigned int)re._classes.size() - 1;
+	}
+
+	size_t group()
+	{
+		bool capture = false;
+		FieldType type = _Unknown;
+		if(peek('?')) {
+			++i;
+			if(peek(':'))
+				++i;
+			else if(peek('<')) {
+				++i;
+				if(!name(type))
+					fail("Unknown field in (?<...>)");
+				capture = true;
+			} else
+				fail("Unknown group (?...)");
+		}
+		//Numbered in the order the groups open
+		size_t index = capture ? new_field(type) : 0;
+		size_t inner = alternation();
+		if(!peek(')'))
+			fail("Missing )");
+		++i;
+		if(!capture)
+			return inner;
+		node save(node::Capture, (unsigned int)index);
+		save.children.push_back(inner);
+		return add(save);
+	}
+
+	//<Field> is (?<Field>.+?); a < not starting a field name is a literal
+	size_t field()
+	{
+		size_t start = i;
+		FieldType type;
+		if(!name(type)) {
+			i = start;
+			return literal('<');
+		}
+		node any(node::Any);
+		node repeat(node::Repeat);
+		repeat.min = 1;
+		repeat.max = UNBOUNDED;
+		repeat.lazy = true;
+		repeat.children.push_back(add(any));
+		node save(node::Capture, (unsigned int)new_field(type));
+		save.children.push_back(add(repeat));
+		return add(save);
+	}
+
+	//A field name and the closing >
+	bool name(FieldType &type)
+	{
+		size_t end = i;
+		while(end < s.size() && s[end] != '>')
+			++end;
+		if(end == s.size())
+			return false;
+		std::vector<unsigned int> candidate(s.begin() + i, s.begin() + end);
+		if(!IsFieldName(candidate, type))
+			return false;
+		i = end + 1;
+		return true;
+	}
+
+	size_t new_field(FieldType type)
+	{
+		if(re._fields.size() == MatchResult::MAX_FIELDS)
+			fail("Too many fields");
+		re._fields.push_back(type);
+		return re._fields.size() - 1;
+	}
+
+	void compile(size_t n)
+	{
+		const node &nd = nodes[n];
+		std::vector<instruction> &program = re._program;
+		switch(nd.kind) {
+		case node::Literal:
+			re.emit(Char, nd.value);
+			break;
+		case node::Any:
+			re.emit(Any);
+			break;
+		case node::Class:
+			re.emit(Class, nd.value);
+			break;
+		case node::Concat:
+			for(size_t k = 0; k < nd.children.size(); ++k)
+				compile(nd.children[k]);
+			break;
+		case node::Alternate: {
+			//Earlier alternatives are preferred
+			std::vector<size_t> jumps;
+			for(size_t k = 0; k + 1 < nd.children.size(); ++k) {
+				size_t split = re.emit(Split);
+				program[split].x = program.size();
+				compile(nd.children[k]);
+				jumps.push_back(re.emit(Jump));
+				program[split].y = program.size();
+			}
+			compile(nd.children.back());
+			for(size_t k = 0; k < jumps.size(); ++k)
+				program[jumps[k]].x = program.size();
+			break;
+		}
+		case node::Capture:
+			re.emit(Save, 2 * nd.value);
+			compile(nd.children[0]);
+			re.emit(Save, 2 * nd.value + 1);
+			break;
+		case node::Repeat: {
+			for(size_t k = 0; k < nd.min; ++k)
+				compile(nd.children[0]);
+			std::vector<size_t> splits;
+			if(nd.max == UNBOUNDED) {
+				size_t split = re.emit(Split);
+				compile(nd.children[0]);
+				re.emit(Jump, 0, split);
+				splits.push_back(split);
+			} else {
+				//Each optional copy may skip all the rest
+				for(size_t k = nd.min; k < nd.max; ++k) {
+					splits.push_back(re.emit(Split));
+					compile(nd.children[0]);
+				}
+			}
+			for(size_t k = 0; k < splits.size(); ++k) {
+				instruction &split = program[splits[k]];
+				split.x = nd.lazy ? program.size() : splits[k] + 1;
+				split.y = nd.lazy ? splits[k] + 1 : program.size();
+			}
+			break;
+		}
+		}
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+
+Regex::Regex(const tstring &expression)
+: _nPathSeparators(0)
+, _leading_separator(false)
+{
+	//The whole name is matched, anchors are implied
+	tstring body = expression;
+	if(!body.empty() && body[0] == _T('^'))
+		body.erase(0, 1);
+	if(!body.empty() && body[body.size()-1] == _T('$')) {
+		size_t escapes = 0;
+		while(escapes + 1 < body.size() && body[body.size()-2-escapes] == _T('\\'))
+			++escapes;
+		if(escapes % 2 == 0)
+			body.erase(body.size()-1);
+	}
+
+	parser p(*this, body);
+	size_t root = p.alternation();
+	if(p.more())
+		p.fail("Unbalanced )");
+	p.compile(root);
+	emit(Accept);
+	_leading_separator = !body.empty() && (body[0] == _T('/') || (body.size() > 1 && body[0] == _T('\\') && body[1] == _T('\\')));
+}
+
+Regex::~Regex()
+{
+}
+
+size_t Regex::emit(Op op, unsigned int arg, size_t x, size_t y)
+{
+	if(_program.size() == MAX_PROGRAM)
+		throw Exc("Invalid expression: Too long.");
+	instruction in;
+	in.op = op;
+	in.arg = arg;
+	in.x = x;
+	in.y = y;
+	_program.push_back(in);
+	return _program.size() - 1;
+}
+
+//Follows jumps, splits and saves, in priority order, to the instructions
+//that consume a character; each is added once per step
+void Regex::add_thread(vm_state &vm, thread_list &list, size_t pc, size_t *slots, size_t pos) const
+{
+	if(vm.mark[pc] == vm.step)
+		return;
+	vm.mark[pc] = vm.step;
+	const instruction &in = _program[pc];
+	switch(in.op) {
+	case Jump:
+		add_thread(vm, list, in.x, slots, pos);
+		break;
+	case Split:
+		add_thread(vm, list, in.x, slots, pos);
+		add_thread(vm, list, in.y, slots, pos);
+		break;
+	case Save: {
+		size_t saved = slots[in.arg];
+		slots[in.arg] = pos;
+		add_thread(vm, list, pc + 1, slots, pos);
+		slots[in.arg] = saved;
+		break;
+	}
+	default: {
+		const size_t nSlots = 2 * _fields.size();
+		list.pcs[list.count] = pc;
+		if(nSlots)
+			std::copy(slots, slots + nSlots, &list.slots[list.count * nSlots]);
+		++list.count;
+		break;
+	}
+	}
+}
+
+bool Regex::match(const char_type *name, size_t size, MatchResult &out) const
+{
+	const size_t nSlots = 2 * _fields.size();
+	vm_state *vm = _state.get();
+	if(!vm) {
+		vm = new vm_state;
+		_state.reset(vm);
+		for(int l = 0; l < 2; ++l) {
+			vm->lists[l].pcs.resize(_program.size());
+			vm->lists[l].slots.resize(_program.size() * nSlots);
+		}
+		vm->mark.assign(_program.size(), 0);
+		vm->slots.resize(nSlots);
+		vm->step = 0;
+	}
+
+	thread_list *current = &vm->lists[0], *next = &vm->lists[1];
+	std::fill(vm->slots.begin(), vm->slots.end(), tstring::npos);
+	current->count = 0;
+	++vm->step;
+	add_thread(*vm, *current, 0, nSlots ? &vm->slots[0] : NULL, 0);
+	for(size_t pos = 0; pos < size && current->count; ) {
+		unsigned int c = NextCodePoint(name, size, pos);
+		next->count = 0;
+		++vm->step;
+		for(size_t t = 0; t < current->count; ++t) {
+			const instruction &in = _program[current->pcs[t]];
+			bool step;
+			switch(in.op) {
+			case Char: step = c == in.arg; break;
+			case Any: step = true; break;
+			case Class: step = _classes[in.arg].contains(c); break;
+			default: step = false; break;
+			}
+			if(step)
+				add_thread(*vm, *next, current->pcs[t] + 1, nSlots ? &current->slots[t * nSlots] : NULL, pos);
+		}
+		std::swap(current, next);
+	}
+
+	//The first thread to accept has the preferred captures
+	for(size_t t = 0; t < current->count; ++t) {
+		if(_program[current->pcs[t]].op != Accept)
+			continue;
+		const size_t *slots = nSlots ? &current->slots[t * nSlots] : NULL;
+		out.count = 0;
+		for(size_t f = 0; f < _fields.size(); ++f) {
+			if(slots[2*f] == tstring::npos || slots[2*f+1] == tstring::npos)
+				continue;
+			FieldSpan &span = out.fields[out.count++];
+			span.type = _fields[f];
+			span.begin = slots[2*f];
+			span.end = slots[2*f+1];
+		}
+		return true;
+	}
+	return false;
+}
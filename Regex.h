@@ -0,0 +1,89 @@
+/*
+ * Regex.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef REGEX_H_
+#define REGEX_H_
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+#include "common.h"
+#include "Pattern.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//The expression of a `re:` pattern, matched against the whole name.
+//
+//Syntax: literal characters, `.`, classes like `[0-9]` or `[^-]`, \d \w \s
+//and their negations, groups `(...)`, alternatives `a|b`, and the
+//quantifiers * + ? {n} {n,} {n,m}, each lazy with a trailing `?`.
+//A field is a named group, `(?<Track#>\d{1,3})`, or just `<Artist>`, which
+//stands for `(?<Artist>.+?)` and so splits names like a plain pattern does.
+//A field in an optional part that did not take part in a match is left out.
+//
+//The expression is compiled once into a program for a Pike VM: all
+//alternatives run in lockstep over the name, one code point at a time, so
+//matching is linear in the length of the name whatever the expression. The
+//VM's thread lists are allocated once per worker thread and reused.
+class Regex : private boost::noncopyable {
+public:
+	explicit Regex(const tstring &expression);		//throws Exc on a syntax error
+	~Regex();
+
+	size_t field_count() const { return _fields.size(); }
+	FieldType field_type(size_t i) const { return _fields[i]; }
+	//Literal path separators, see Pattern::get_separator_count
+	size_t get_separator_count() const { return _nPathSeparators; }
+	bool begins_with_separator() const { return _leading_separator; }
+
+	//Fills out.fields with the fields of a match of the whole name
+	bool match(const char_type *name, size_t size, MatchResult &out) const;
+
+protected:
+	enum { MAX_PROGRAM = 2048, MAX_REPEAT = 255 };
+	enum Op {Char, Any, Class, Split, Jump, Save, Accept};
+	struct instruction {
+		Op op;
+		unsigned int arg;			//code point, class or capture slot
+		size_t x;					//next for Jump, preferred next for Split
+		size_t y;					//other next for Split
+	};
+	struct char_class {
+		unsigned long long ascii[2];	//code points below 128
+		std::vector<std::pair<unsigned int, unsigned int> > ranges;	//the others, inclusive
+		bool negated;
+
+		char_class() : negated(false) { ascii[0] = ascii[1] = 0; }
+		void add(unsigned int first, unsigned int last);
+		bool contains(unsigned int c) const;
+	};
+	//Per-thread working memory of match
+	struct thread_list {
+		std::vector<size_t> pcs;
+		std::vector<size_t> slots;		//capture slots of each entry of pcs
+		size_t count;
+	};
+	struct vm_state {
+		thread_list lists[2];
+		std::vector<size_t> mark;		//pc -> step it was last added in
+		std::vector<size_t> slots;		//of the thread being started
+		size_t step;
+	};
+	struct parser;
+
+	size_t emit(Op op, unsigned int arg = 0, size_t x = 0, size_t y = 0);
+	void add_thread(vm_state &vm, thread_list &list, size_t pc, size_t *slots, size_t pos) const;
+
+protected:
+	std::vector<instruction> _program;
+	std::vector<char_class> _classes;
+	std::vector<FieldType> _fields;			//capture i saves to slots 2i and 2i+1
+	size_t _nPathSeparators;
+	bool _leading_separator;
+	mutable boost::thread_specific_ptr<vm_state> _state;
+};
+
+#endif /* REGEX_H_ */
@@ -0,0 +1,230 @@
+/*
+ * RunIndex.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "RunIndex.h"
+#include "ContentHash.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifndef BOOST_WINDOWS_API
+	#include <sys/stat.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////
+
+#ifdef BOOST_WINDOWS_API
+	bool StatFile(const fs::path &file, file_stat &out)
+	{
+		boost::system::error_code ec;
+		out.size = fs::file_size(file, ec);
+		if(ec)
+			return false;
+		out.mtime = (boost::int64_t)fs::last_write_time(file, ec) * 1000000000LL;
+		out.inode = 0;
+		return !ec;
+	}
+
+#else
+	bool StatFile(const fs::path &file, file_stat &out)
+	{
+		struct stat st;
+		if(::stat(file.c_str(), &st) != 0)
+			return false;
+		out.size = st.st_size;
+	#ifdef __linux__
+		out.mtime = (boost::int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	#else
+		out.mtime = (boost::int64_t)st.st_mtime * 1000000000LL;
+	#endif
+		out.inode = st.st_ino;
+		return true;
+	}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	const char INDEX_MAGIC[8] = {'M','P','3','T','I','D','X','1'};
+	const boost::uint32_t INDEX_VERSION = 3;
+
+	struct index_header {
+		char magic[8];
+		boost::uint32_t version;
+		boost::uint32_t record_size;
+		boost::uint64_t count;
+	};
+
+	bool ByPath(const RunIndex::record &a, const RunIndex::record &b)
+	{
+		if(a.path_hash != b.path_hash)
+			return a.path_hash < b.path_hash;
+		return a.path_check < b.path_check;
+	}
+
+	bool SamePath(const RunIndex::record &a, const RunIndex::record &b)
+	{
+		return a.path_hash == b.path_hash && a.path_check == b.path_check;
+	}
+}
+
+RunIndex::RunIndex(const fs::path &file)
+: _file(file)
+, _records(NULL)
+, _count(0)
+{
+	Load();
+}
+
+RunIndex::~RunIndex()
+{
+}
+
+void RunIndex::Load()
+{
+	namespace ip = boost::interprocess;
+	_region.reset();
+	_mapping.reset();
+	_records = NULL;
+	_count = 0;
+
+	boost::system::error_code ec;
+	boost::uintmax_t size = fs::file_size(_file, ec);
+	if(ec || size < sizeof(index_header))
+		return;						//first run
+
+	try {
+		_mapping.reset(new ip::file_mapping(_file.string().c_str(), ip::read_only));
+		_region.reset(new ip::mapped_region(*_mapping, ip::read_only));
+	} catch (const ip::interprocess_exception& ex) {
+		Log << _T("Index ") << _file.string<tstring>() << _T(" not loaded: ") << ex.what() << std::endl;
+		_region.reset();
+		_mapping.reset();
+		return;
+	}
+
+	const index_header *header = static_cast<const index_header*>(_region->get_address());
+	if(memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+		|| header->version != INDEX_VERSION
+		|| header->record_size != sizeof(record)
+		|| size < sizeof(index_header) + header->count * sizeof(record)) {
+		Log << _T("Index ") << _file.string<tstring>() << _T(" is not valid, ignoring it") << std::endl;
+		_region.reset();
+		_mapping.reset();
+		return;
+	}
+	_records = reinterpret_cast<const record*>(header + 1);
+	_count = (size_t)header->count;
+	_region->advise(ip::mapped_region::advice_willneed);
+}
+
+const RunIndex::record *RunIndex::Find(const fs::path &file) const
+{
+	record key;
+	key.path_hash = HashPath(file);
+	key.path_check = CheckPath(file);
+	const record *end = _records + _count;
+	const record *it = std::lower_bound(_records, end, key, ByPath);
+	return (it != end && SamePath(*it, key)) ? it : NULL;
+}
+
+bool RunIndex::IsCurrent(const fs::path &file, const file_stat &stat, boost::uint64_t pattern_hash) const
+{
+	const record *r = Find(file);
+	return r && r->pattern_hash == pattern_hash
+			&& r->size == stat.size && r->mtime == stat.mtime && r->inode == stat.inode;
+}
+
+bool RunIndex::ContentHash(const fs::path &file, const file_stat &stat, boost::uint64_t &hash) const
+{
+	const record *r = Find(file);
+	if(!r || !r->content_hash || r->size != stat.size || r->mtime != stat.mtime || r->inode != stat.inode)
+		return false;
+	hash = r->content_hash;
+	return true;
+}
+
+void RunIndex::Record(const fs::path &file, const file_stat &stat, boost::uint64_t pattern_hash, Outcome outcome,
+		boost::uint64_t content_hash)
+{
+	record r;
+	r.path_hash = HashPath(file);
+	r.path_check = CheckPath(file);
+	r.size = stat.size;
+	r.mtime = stat.mtime;
+	r.inode = stat.inode;
+	r.pattern_hash = pattern_hash;
+	r.content_hash = content_hash;
+	if(!content_hash)
+		ContentHash(file, stat, r.content_hash);
+	r.outcome = outcome;
+	r.reserved = 0;
+
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	_updates.push_back(r);
+}
+
+void RunIndex::Save()
+{
+	boost::lock_guard<boost::mutex> lock(_mtx);
+
+	//Latest update per path wins over older updates and over the loaded index
+	std::stable_sort(_updates.begin(), _updates.end(), ByPath);
+	std::vector<record> merged;
+	merged.reserve(_count + _updates.size());
+	const record *old = _records;
+	const record *old_end = _records + _count;
+	for(size_t i = 0; i < _updates.size(); ++i) {
+		if(i + 1 < _updates.size() && SamePath(_updates[i+1], _updates[i]))
+			continue;
+		while(old != old_end && ByPath(*old, _updates[i]))
+			merged.push_back(*old++);
+		if(old != old_end && SamePath(*old, _updates[i]))
+			++old;
+		merged.push_back(_updates[i]);
+	}
+	merged.insert(merged.end(), old, old_end);
+
+	index_header header;
+	memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	header.version = INDEX_VERSION;
+	header.record_size = sizeof(record);
+	header.count = merged.size();
+
+	//Write aside, then swap in with a rename so a crash leaves the old index intact
+	fs::path tmp = _file;
+	tmp += ".tmp";
+	{
+		std::ofstream out(tmp.string().c_str(), std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		if(!merged.empty())
+			out.write(reinterpret_cast<const char*>(&merged[0]), merged.size() * sizeof(record));
+		out.close();
+		if(!out || !SyncFile(tmp)) {
+			LogError << _T("Cannot write index ") << tmp.string<tstring>() << std::endl;
+			return;
+		}
+	}
+	_region.reset();				//Windows cannot replace a mapped file
+	_mapping.reset();
+	fs::rename(tmp, _file);
+	_updates.clear();
+	Load();
+}
+
+boost::uint64_t RunIndex::HashPath(const fs::path &file)
+{
+	const fs::path::string_type &native = file.native();
+	return HashBytes(native.data(), native.size() * sizeof(fs::path::value_type));
+}
+
+boost::uint64_t RunIndex::CheckPath(const fs::path &file)
+{
+	const fs::path::string_type &native = file.native();
+	xxh64 h;
+	h.update(native.data(), native.size() * sizeof(fs::path::value_type));
+	return h.digest();
+}
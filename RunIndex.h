@@ -0,0 +1,86 @@
+/*
+ * RunIndex.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef RUNINDEX_H_
+#define RUNINDEX_H_
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//What identifies a file version on disk
+struct file_stat {
+	boost::uint64_t size;
+	boost::int64_t mtime;			//nanoseconds where the platform has them
+	boost::uint64_t inode;			//0 where the platform has none
+
+	bool operator==(const file_stat &o) const { return size == o.size && mtime == o.mtime && inode == o.inode; }
+};
+
+bool StatFile(const fs::path &file, file_stat &out);
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Outcome of previous runs, so unchanged files can be skipped without opening them.
+//
+//The file is a header followed by fixed-size records sorted by path hash. A
+//second, independent hash of the path is kept to tell colliding paths apart. It is
+//memory mapped read-only, so lookups from the workers need no lock. Results of
+//the current run are collected in memory and merged into a new file by Save(),
+//which replaces the old one with a rename.
+class RunIndex {
+public:
+	enum Outcome {Tagged = 1, TagRejected, Unchanged, NameRejected};
+
+	struct record {
+		boost::uint64_t path_hash;
+		boost::uint64_t path_check;		//XXH64 of the path
+		boost::uint64_t size;
+		boost::int64_t mtime;
+		boost::uint64_t inode;
+		boost::uint64_t pattern_hash;
+		boost::uint64_t content_hash;	//of the audio, 0 if not computed
+		boost::uint32_t outcome;
+		boost::uint32_t reserved;
+	};
+
+	explicit RunIndex(const fs::path &file);
+	~RunIndex();
+
+	//True if file was handled by a run with the same pattern_hash and has not changed since
+	bool IsCurrent(const fs::path &file, const file_stat &stat, boost::uint64_t pattern_hash) const;
+	//The audio hash recorded for file, if it has not changed since
+	bool ContentHash(const fs::path &file, const file_stat &stat, boost::uint64_t &hash) const;
+	//Without a content_hash, the one recorded for the same file version is kept
+	void Record(const fs::path &file, const file_stat &stat, boost::uint64_t pattern_hash, Outcome outcome,
+			boost::uint64_t content_hash = 0);
+	void Save();
+
+	size_t size() const { return _count; }
+	static boost::uint64_t HashPath(const fs::path &file);
+	static boost::uint64_t CheckPath(const fs::path &file);
+
+protected:
+	void Load();
+	const record *Find(const fs::path &file) const;
+
+protected:
+	fs::path _file;
+	boost::scoped_ptr<boost::interprocess::file_mapping> _mapping;
+	boost::scoped_ptr<boost::interprocess::mapped_region> _region;
+	const record *_records;
+	size_t _count;
+	//This run
+	boost::mutex _mtx;
+	std::vector<record> _updates;
+};
+
+#endif /* RUNINDEX_H_ */
@@ -0,0 +1,177 @@
+/*
+ * TagBackend.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "TagBackend.h"
+#include <cstring>
+#include <fstream>
+#include <boost/scoped_ptr.hpp>
+#include <taglib/flacfile.h>
+#include <taglib/id3v2framefactory.h>
+#include <taglib/mp4file.h>
+#include <taglib/mpegfile.h>
+#include <taglib/tfilestream.h>
+#include <taglib/vorbisfile.h>
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	//A read-only stream, constructed before the file that reads it and
+	//destroyed after it; TagLib's File does not own a stream it is given
+	struct read_only_stream {
+		boost::scoped_ptr<TagLib::FileStream> reader;
+		explicit read_only_stream(const fs::path &file) : reader(new TagLib::FileStream(file.string<tstring>().c_str(), true)) {}
+	};
+
+	//MPEG and FLAC files also take the factory of their ID3v2 frames
+	template <class F>
+	class ReadOnlyId3 : private read_only_stream, public F {
+	public:
+		explicit ReadOnlyId3(const fs::path &file)
+		: read_only_stream(file), F(reader.get(), TagLib::ID3v2::FrameFactory::instance(), false) {}
+	};
+
+	template <class F>
+	class ReadOnly : private read_only_stream, public F {
+	public:
+		explicit ReadOnly(const fs::path &file) : read_only_stream(file), F(reader.get(), false) {}
+	};
+
+	//Without audio properties; a file TagLib cannot parse is not of this format
+	template <class F, class R>
+	TagLib::File *OpenAs(const fs::path &file, bool read_only)
+	{
+		TagLib::File *f = read_only ? static_cast<TagLib::File*>(new R(file)) : new F(file.string<tstring>().c_str(), false);
+		if(f->isValid())
+			return f;
+		delete f;
+		return NULL;
+	}
+
+	class MpegBackend : public TagBackend {
+	public:
+		const char *name() const { return "mpeg"; }
+		TagLib::File *Open(const fs::path &file, bool read_only) const { return OpenAs<TagLib::MPEG::File, ReadOnlyId3<TagLib::MPEG::File> >(file, read_only); }
+		bool direct_id3() const { return true; }
+	};
+
+	class FlacBackend : public TagBackend {
+	public:
+		const char *name() const { return "flac"; }
+		TagLib::File *Open(const fs::path &file, bool read_only) const { return OpenAs<TagLib::FLAC::File, ReadOnlyId3<TagLib::FLAC::File> >(file, read_only); }
+	};
+
+	class Mp4Backend : public TagBackend {
+	public:
+		const char *name() const { return "mp4"; }
+		TagLib::File *Open(const fs::path &file, bool read_only) const { return OpenAs<TagLib::MP4::File, ReadOnly<TagLib::MP4::File> >(file, read_only); }
+	};
+
+	class VorbisBackend : public TagBackend {
+	public:
+		const char *name() const { return "vorbis"; }
+		TagLib::File *Open(const fs::path &file, bool read_only) const { return OpenAs<TagLib::Ogg::Vorbis::File, ReadOnly<TagLib::Ogg::Vorbis::File> >(file, read_only); }
+	};
+
+	MpegBackend g_mpeg;
+	FlacBackend g_flac;
+	Mp4Backend g_mp4;
+	VorbisBackend g_vorbis;
+
+	//The extension of name, up to 7 ASCII characters, lower case, one per
+	//byte from the last; 0 if there is none or it cannot be registered
+	boost::uint64_t ExtensionKey(const fs::path::string_type &name)
+	{
+		boost::uint64_t key = 0;
+		for(size_t i = name.size(), n = 0; i-- > 0 && n <= 7; ++n) {
+			fs::path::value_type c = name[i];
+			if(c == '.')
+				return n ? key : 0;
+			if(c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+			else if(c <= ' ' || c > '~' || c == '/' || c == '\\')
+				return 0;
+			key |= (boost::uint64_t)c << (8 * n);
+		}
+		return 0;
+	}
+
+	//Open addressing, never more than a quarter full
+	class extension_table {
+	public:
+		extension_table()
+		{
+			memset(_keys, 0, sizeof(_keys));
+			memset(_backends, 0, sizeof(_backends));
+			Add(".mp3", &g_mpeg);
+			Add(".flac", &g_flac);
+			Add(".m4a", &g_mp4);
+			Add(".m4b", &g_mp4);
+			Add(".mp4", &g_mp4);
+			Add(".ogg", &g_vorbis);
+			Add(".oga", &g_vorbis);
+		}
+
+		const TagBackend *Find(boost::uint64_t key) const
+		{
+			for(size_t i = Slot(key); _keys[i]; i = (i + 1) % SIZE)
+				if(_keys[i] == key)
+					return _backends[i];
+			return NULL;
+		}
+
+	private:
+		static const size_t BITS = 5;
+		static const size_t SIZE = 1 << BITS;
+
+		static size_t Slot(boost::uint64_t key) { return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - BITS)); }
+
+		void Add(const char *extension, const TagBackend *backend)
+		{
+			boost::uint64_t key = ExtensionKey(fs::path(extension).native());
+			size_t i = Slot(key);
+			while(_keys[i])
+				i = (i + 1) % SIZE;
+			_keys[i] = key;
+			_backends[i] = backend;
+		}
+
+		boost::uint64_t _keys[SIZE];
+		const TagBackend *_backends[SIZE];
+	};
+
+	const extension_table g_extensions;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+const TagBackend *TagBackend::ForFile(const fs::path &file)
+{
+	return g_extensions.Find(ExtensionKey(file.native()));
+}
+
+const TagBackend *TagBackend::Mpeg()
+{
+	return &g_mpeg;
+}
+
+const TagBackend *TagBackend::Sniff(const fs::path &file)
+{
+	unsigned char head[36];
+	std::ifstream in(file.string().c_str(), std::ios::binary);
+	in.read(reinterpret_cast<char*>(head), sizeof(head));
+	size_t n = (size_t)in.gcount();
+	if(n >= 3 && memcmp(head, "ID3", 3) == 0)
+		return &g_mpeg;
+	if(n >= 2 && head[0] == 0xFF && (head[1] & 0xE0) == 0xE0)	//MPEG frame sync
+		return &g_mpeg;
+	if(n >= 4 && memcmp(head, "fLaC", 4) == 0)
+		return &g_flac;
+	if(n >= 8 && memcmp(head + 4, "ftyp", 4) == 0)
+		return &g_mp4;
+	if(n >= 35 && memcmp(head, "OggS", 4) == 0 && memcmp(head + 28, "\x01vorbis", 7) == 0)
+		return &g_vorbis;
+	return NULL;
+}
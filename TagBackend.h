@@ -0,0 +1,46 @@
+/*
+ * TagBackend.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef TAGBACKEND_H_
+#define TAGBACKEND_H_
+
+#define TAGLIB_STATIC
+
+#include <taglib/tfile.h>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//How the files of one format are opened: MP3 (ID3), FLAC and Ogg Vorbis
+//(Vorbis comments) and MP4 (iTunes atoms).
+//
+//A backend opens its format through TagLib's class for it, so neither the
+//file name nor its contents are guessed at again; copies saved aside under
+//another name open the same way. TagLib opens a file for writing whenever
+//it can, and closing it then reports a write to inotify, so files that are
+//only read are opened read-only. Plain ID3v2 tags are read and written by
+//Id3v2Tag before TagLib is tried.
+//
+//ForFile() finds the backend of an extension, in any case, in a small hash
+//table keyed by the extension packed into an integer, without a string
+//compare; Sniff() reads the first bytes of files whose extension says nothing.
+class TagBackend {
+public:
+	virtual ~TagBackend() {}
+
+	virtual const char *name() const = 0;
+	//The file through TagLib, NULL if it does not hold this format; one
+	//opened read_only cannot be saved
+	virtual TagLib::File *Open(const fs::path &file, bool read_only) const = 0;
+	//Plain ID3v2 tags can be handled by Id3v2Tag
+	virtual bool direct_id3() const { return false; }
+
+	static const TagBackend *ForFile(const fs::path &file);
+	static const TagBackend *Sniff(const fs::path &file);
+	static const TagBackend *Mpeg();
+};
+
+#endif /* TAGBACKEND_H_ */
@@ -0,0 +1,148 @@
+/*
+ * TagValues.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "TagValues.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+void PutU32(std::string &out, boost::uint32_t v)
+{
+	out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void PutU64(std::string &out, boost::uint64_t v)
+{
+	out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void PutBytes(std::string &out, const void *data, size_t size)
+{
+	PutU32(out, (boost::uint32_t)size);
+	out.append(static_cast<const char*>(data), size);
+}
+
+bool GetBytes(const char *&p, const char *end, std::string &out)
+{
+	boost::uint32_t size;
+	if(!Get(p, end, size) || (size_t)(end - p) < size)
+		return false;
+	out.assign(p, size);
+	p += size;
+	return true;
+}
+
+void PutPath(std::string &out, const fs::path &file)
+{
+	const fs::path::string_type &native = file.native();
+	PutBytes(out, native.data(), native.size() * sizeof(fs::path::value_type));
+}
+
+bool GetPath(const char *&p, const char *end, fs::path &file)
+{
+	std::string bytes;
+	if(!GetBytes(p, end, bytes) || bytes.size() % sizeof(fs::path::value_type))
+		return false;
+	const fs::path::value_type *chars = reinterpret_cast<const fs::path::value_type*>(bytes.data());
+	file = fs::path(fs::path::string_type(chars, chars + bytes.size() / sizeof(fs::path::value_type)));
+	return true;
+}
+
+void PutRecord(std::string &out, int type, boost::uint64_t number, const std::string &rest)
+{
+	std::string body(1, (char)type);
+	PutU64(body, number);
+	body += rest;
+	PutU32(out, (boost::uint32_t)body.size());
+	PutU64(out, HashBytes(body.data(), body.size()));
+	out += body;
+}
+
+bool NextRecord(const char *&p, const char *end, int &type, boost::uint64_t &number,
+		const char *&rest, const char *&rest_end)
+{
+	boost::uint32_t size;
+	boost::uint64_t checksum;
+	const char *body = p;
+	if(!Get(body, end, size) || !Get(body, end, checksum) || (size_t)(end - body) < size
+		|| size < 1 + sizeof(number) || HashBytes(body, size) != checksum)
+		return false;
+	rest_end = body + size;
+	type = (unsigned char)*body++;
+	Get(body, rest_end, number);
+	rest = body;
+	p = rest_end;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	void PutString(std::string &out, const TagLib::String &s)
+	{
+		TagLib::ByteVector v = s.data(TagLib::String::UTF8);
+		PutBytes(out, v.data(), v.size());
+	}
+
+	bool GetString(const char *&p, const char *end, TagLib::String &s)
+	{
+		std::string bytes;
+		if(!GetBytes(p, end, bytes))
+			return false;
+		s = TagLib::String(TagLib::ByteVector(bytes.data(), (unsigned int)bytes.size()), TagLib::String::UTF8);
+		return true;
+	}
+}
+
+tag_values::tag_values(const TagLib::Tag *tag)
+: title(tag->title())
+, artist(tag->artist())
+, album(tag->album())
+, comment(tag->comment())
+, genre(tag->genre())
+, year(tag->year())
+, track(tag->track())
+{
+}
+
+void tag_values::ApplyTo(TagLib::Tag *tag) const
+{
+	tag->setTitle(title);
+	tag->setArtist(artist);
+	tag->setAlbum(album);
+	tag->setComment(comment);
+	tag->setGenre(genre);
+	tag->setYear(year);
+	tag->setTrack(track);
+}
+
+bool tag_values::operator==(const tag_values &o) const
+{
+	return title == o.title && artist == o.artist && album == o.album && comment == o.comment
+		&& genre == o.genre && year == o.year && track == o.track;
+}
+
+void tag_values::Encode(std::string &out) const
+{
+	PutString(out, title);
+	PutString(out, artist);
+	PutString(out, album);
+	PutString(out, comment);
+	PutString(out, genre);
+	PutU32(out, year);
+	PutU32(out, track);
+}
+
+bool tag_values::Decode(const char *&p, const char *end)
+{
+	boost::uint32_t y, t;
+	if(!GetString(p, end, title) || !GetString(p, end, artist) || !GetString(p, end, album)
+		|| !GetString(p, end, comment) || !GetString(p, end, genre)
+		|| !Get(p, end, y) || !Get(p, end, t))
+		return false;
+	year = y;
+	track = t;
+	return true;
+}
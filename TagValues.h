@@ -0,0 +1,67 @@
+/*
+ * TagValues.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef TAGVALUES_H_
+#define TAGVALUES_H_
+
+#define TAGLIB_STATIC
+
+#include <cstring>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <taglib/tag.h>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//The fields the tagger writes, as a tag holds them
+struct tag_values {
+	TagLib::String title;
+	TagLib::String artist;
+	TagLib::String album;
+	TagLib::String comment;
+	TagLib::String genre;
+	TagLib::uint year;
+	TagLib::uint track;
+
+	tag_values() : year(0), track(0) {}
+	explicit tag_values(const TagLib::Tag *tag);
+	void ApplyTo(TagLib::Tag *tag) const;
+	bool operator==(const tag_values &o) const;
+
+	//Length-prefixed UTF-8 fields, for the journal and the undo log
+	void Encode(std::string &out) const;
+	bool Decode(const char *&p, const char *end);
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Records of the journal and the undo log, in native byte order: size,
+//checksum, then the body: a type, a number (sequence or path hash) and the rest
+void PutRecord(std::string &out, int type, boost::uint64_t number, const std::string &rest);
+//Checks the record at p and moves past it; false at the end or at a record
+//torn by a crash
+bool NextRecord(const char *&p, const char *end, int &type, boost::uint64_t &number,
+		const char *&rest, const char *&rest_end);
+
+void PutU32(std::string &out, boost::uint32_t v);
+void PutU64(std::string &out, boost::uint64_t v);
+void PutBytes(std::string &out, const void *data, size_t size);
+void PutPath(std::string &out, const fs::path &file);
+bool GetBytes(const char *&p, const char *end, std::string &out);
+bool GetPath(const char *&p, const char *end, fs::path &file);
+
+template <class T>
+bool Get(const char *&p, const char *end, T &v)
+{
+	if((size_t)(end - p) < sizeof(T))
+		return false;
+	memcpy(&v, p, sizeof(T));
+	p += sizeof(T);
+	return true;
+}
+
+#endif /* TAGVALUES_H_ */
@@ -0,0 +1,130 @@
+/*
+ * UndoLog.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "UndoLog.h"
+#include "RunIndex.h"
+#include <cstring>
+#include <set>
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	const char UNDO_MAGIC[8] = {'M','P','3','T','U','N','D','1'};
+	const int UNDO_RECORD = 1;
+}
+
+UndoLog::UndoLog(const fs::path &file)
+: _file(file)
+, _valid_size(0)
+{
+}
+
+UndoLog::~UndoLog()
+{
+}
+
+bool UndoLog::OpenForAppend()
+{
+	boost::system::error_code ec;
+	bool exists = fs::exists(_file, ec) && fs::file_size(_file, ec) > 0;
+	if(exists) {
+		if(!Load())
+			return false;
+		//Later records would be lost behind a torn one
+		_entries.clear();
+		_region.reset();
+		_mapping.reset();
+		if(_valid_size < fs::file_size(_file, ec)) {
+			fs::resize_file(_file, _valid_size, ec);
+			if(ec) {
+				LogError << _T("Cannot truncate undo log ") << _file.string<tstring>() << _T(": ") << ec.message() << std::endl;
+				return false;
+			}
+		}
+	}
+	_out.open(_file.string().c_str(), std::ios::binary | std::ios::app);
+	if(!exists)
+		_out.write(UNDO_MAGIC, sizeof(UNDO_MAGIC));
+	_out.flush();
+	if(!_out) {
+		LogError << _T("Cannot write undo log ") << _file.string<tstring>() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//Flushed before the file is written, so the old values survive a crash of the tagger
+void UndoLog::Record(const fs::path &file, const tag_values &before)
+{
+	std::string rest;
+	PutPath(rest, file);
+	before.Encode(rest);
+	std::string record;
+	PutRecord(record, UNDO_RECORD, RunIndex::HashPath(file), rest);
+
+	boost::lock_guard<boost::mutex> lock(_mtx);
+	_out.write(record.data(), record.size());
+	_out.flush();
+	if(!_out)
+		throw Exc("Cannot write the undo log");
+}
+
+void UndoLog::Close()
+{
+	if(_out.is_open())
+		_out.close();
+}
+
+bool UndoLog::Load()
+{
+	namespace ip = boost::interprocess;
+	_entries.clear();
+	_region.reset();
+	_mapping.reset();
+	_valid_size = 0;
+
+	try {
+		_mapping.reset(new ip::file_mapping(_file.string().c_str(), ip::read_only));
+		_region.reset(new ip::mapped_region(*_mapping, ip::read_only));
+	} catch (const ip::interprocess_exception& ex) {
+		LogError << _T("Cannot read undo log ") << _file.string<tstring>() << _T(": ") << ex.what() << std::endl;
+		_region.reset();
+		_mapping.reset();
+		return false;
+	}
+	const char *begin = static_cast<const char*>(_region->get_address());
+	const char *end = begin + _region->get_size();
+	if(_region->get_size() < sizeof(UNDO_MAGIC) || memcmp(begin, UNDO_MAGIC, sizeof(UNDO_MAGIC)) != 0) {
+		LogError << _T("Undo log ") << _file.string<tstring>() << _T(" is not an undo log") << std::endl;
+		_region.reset();
+		_mapping.reset();
+		return false;
+	}
+	_region->advise(ip::mapped_region::advice_sequential);
+
+	//By the path each record holds, not its hash
+	std::set<fs::path> seen;
+	const char *p = begin + sizeof(UNDO_MAGIC);
+	int type;
+	boost::uint64_t path_hash;
+	const char *rest, *rest_end;
+	while(NextRecord(p, end, type, path_hash, rest, rest_end)) {
+		fs::path file;
+		const char *body = rest;
+		if(type == UNDO_RECORD && GetPath(body, rest_end, file) && seen.insert(file).second)
+			_entries.push_back(std::make_pair(rest, rest_end));
+	}
+	_valid_size = p - begin;
+	if(p != end)
+		Log << _T("Undo log: ignoring a torn record at byte ") << _valid_size << std::endl;
+	return true;
+}
+
+bool UndoLog::Entry(size_t i, fs::path &file, tag_values &before) const
+{
+	const char *p = _entries[i].first;
+	return GetPath(p, _entries[i].second, file) && before.Decode(p, _entries[i].second);
+}
@@ -0,0 +1,56 @@
+/*
+ * UndoLog.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef UNDOLOG_H_
+#define UNDOLOG_H_
+
+#include <fstream>
+#include <utility>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "common.h"
+#include "TagValues.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Tag values of files as they were before a run changed them, to put back
+//with --revert.
+//
+//A tagging run appends one record per file it writes, before writing it:
+//the path and the old values, in the record format of the journal. Runs
+//may share a log; a file written by several of them is reverted to its
+//values before the first. Reading maps the log and indexes its records,
+//which the workers then decode in parallel without a lock.
+class UndoLog {
+public:
+	explicit UndoLog(const fs::path &file);
+	~UndoLog();
+
+	//Writing: starts the log, or continues it after what was left intact
+	bool OpenForAppend();
+	//Returns once the record is in the file; throws if it cannot be written
+	void Record(const fs::path &file, const tag_values &before);
+	void Close();
+
+	//Reading
+	bool Load();
+	size_t size() const { return _entries.size(); }
+	bool Entry(size_t i, fs::path &file, tag_values &before) const;
+
+protected:
+	fs::path _file;
+	boost::mutex _mtx;
+	std::ofstream _out;
+	boost::scoped_ptr<boost::interprocess::file_mapping> _mapping;
+	boost::scoped_ptr<boost::interprocess::mapped_region> _region;
+	std::vector<std::pair<const char*, const char*> > _entries;	//first record of each file
+	boost::uint64_t _valid_size;	//up to the end, or to a record torn by a crash
+};
+
+#endif /* UNDOLOG_H_ */
@@ -0,0 +1,136 @@
+/*
+ * Utf8.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Utf8.h"
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTF8_SSE2
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	void AppendUtf8(std::string &out, unsigned int code)
+	{
+		if(code < 0x80)
+			out += (char)code;
+		else if(code < 0x800) {
+			out += (char)(0xC0 | code >> 6);
+			out += (char)(0x80 | (code & 0x3F));
+		} else if(code < 0x10000) {
+			out += (char)(0xE0 | code >> 12);
+			out += (char)(0x80 | ((code >> 6) & 0x3F));
+			out += (char)(0x80 | (code & 0x3F));
+		} else {
+			out += (char)(0xF0 | code >> 18);
+			out += (char)(0x80 | ((code >> 12) & 0x3F));
+			out += (char)(0x80 | ((code >> 6) & 0x3F));
+			out += (char)(0x80 | (code & 0x3F));
+		}
+	}
+}
+
+size_t AsciiPrefix(const char *s, size_t size)
+{
+	size_t i = 0;
+#ifdef UTF8_SSE2
+	//The top bit of every byte at once
+	for(; i + 16 <= size; i += 16)
+		if(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i))))
+			break;
+#else
+	for(; i + 8 <= size; i += 8) {
+		boost::uint64_t word;
+		memcpy(&word, s + i, sizeof(word));
+		if(word & 0x8080808080808080ULL)
+			break;
+	}
+#endif
+	while(i < size && !(s[i] & 0x80))
+		++i;
+	return i;
+}
+
+bool IsValidUtf8(const char *s, size_t size)
+{
+	const unsigned char *p = reinterpret_cast<const unsigned char*>(s);
+	for(size_t i = AsciiPrefix(s, size); i < size; i += AsciiPrefix(s + i, size - i)) {
+		unsigned char c = p[i];
+		size_t extra;
+		unsigned int code, min;
+		if(c >= 0xC2 && c <= 0xDF) {
+			extra = 1; code = c & 0x1F; min = 0x80;
+		} else if((c & 0xF0) == 0xE0) {
+			extra = 2; code = c & 0x0F; min = 0x800;
+		} else if(c >= 0xF0 && c <= 0xF4) {
+			extra = 3; code = c & 0x07; min = 0x10000;
+		} else
+			return false;
+		if(size - i - 1 < extra)
+			return false;
+		for(size_t k = 1; k <= extra; ++k) {
+			if((p[i + k] & 0xC0) != 0x80)
+				return false;
+			code = code << 6 | (p[i + k] & 0x3F);
+		}
+		if(code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+			return false;
+		i += extra + 1;
+	}
+	return true;
+}
+
+#ifdef BOOST_WINDOWS_API
+
+std::string ToUtf8(const char_type *s, size_t size)
+{
+	std::string out;
+	out.reserve(size);
+	for(size_t i = 0; i < size; ) {
+		unsigned int c = s[i++];
+		if(c < 0x80) {
+			out += (char)c;
+			continue;
+		}
+		if(c >= 0xD800 && c <= 0xDBFF && i < size && s[i] >= 0xDC00 && s[i] <= 0xDFFF)
+			c = 0x10000 + ((c - 0xD800) << 10) + (s[i++] - 0xDC00);
+		else if(c >= 0xD800 && c <= 0xDFFF)
+			c = 0xFFFD;				//unpaired surrogate
+		AppendUtf8(out, c);
+	}
+	return out;
+}
+
+TagLib::String ToTagString(const char_type *s, size_t size)
+{
+	return TagLib::String(std::wstring(s, size));
+}
+
+#else
+
+std::string ToUtf8(const char_type *s, size_t size)
+{
+	if(IsValidUtf8(s, size))
+		return std::string(s, size);
+	std::string out;
+	out.reserve(size * 2);
+	for(size_t i = 0; i < size; ++i)
+		AppendUtf8(out, (unsigned char)s[i]);		//Latin-1
+	return out;
+}
+
+TagLib::String ToTagString(const char_type *s, size_t size)
+{
+	//ASCII is the same in both and Latin-1 is copied without decoding
+	size_t ascii = AsciiPrefix(s, size);
+	bool utf8 = ascii < size && IsValidUtf8(s + ascii, size - ascii);
+	return TagLib::String(std::string(s, size), utf8 ? TagLib::String::UTF8 : TagLib::String::Latin1);
+}
+
+#endif
@@ -0,0 +1,38 @@
+/*
+ * Utf8.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#define TAGLIB_STATIC
+
+#include <string>
+#include <taglib/tstring.h>
+#include "common.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+//Text taken from file names, on its way into tags and the catalog.
+//
+//Names are UTF-8 on POSIX systems and UTF-16 on Windows. A POSIX name that
+//is not valid UTF-8 was most likely written as Latin-1 and is read as such.
+//Most names are plain ASCII, so every function first skips ASCII, 16 bytes
+//at a time with SSE2. Nothing here keeps state, so the workers can call it
+//freely.
+
+//Length of the leading run of ASCII characters
+size_t AsciiPrefix(const char *s, size_t size);
+//Well-formed UTF-8: no overlong forms, surrogates or code points past U+10FFFF
+bool IsValidUtf8(const char *s, size_t size);
+
+std::string ToUtf8(const char_type *s, size_t size);
+inline std::string ToUtf8(const tstring &s) { return ToUtf8(s.data(), s.size()); }
+
+//With the encoding stated, instead of TagLib's Latin-1 default for std::string
+TagLib::String ToTagString(const char_type *s, size_t size);
+inline TagLib::String ToTagString(const tstring &s) { return ToTagString(s.data(), s.size()); }
+
+#endif /* UTF8_H_ */
@@ -0,0 +1,180 @@
+/*
+ * PatternBench.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+//Micro-benchmark for the file name matcher, independent of TagLib and the file system.
+//
+//Usage: pattern_bench [-n count] [-k errors] [-e chars]... [-p pattern]... [names-file]
+//
+//Without a names file, synthetic names are generated for each pattern
+//(roughly one in ten does not match). With a names file (one name per line,
+//e.g. the output of `find -printf '%f\n'`) every pattern is run over it.
+//Reports names/second and heap allocations per name for Pattern::match
+//and for Pattern::match_batch. -k and -e turn on tolerant delimiters
+//(see Pattern::SetTolerance); the names that do not match then pay for it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "../Pattern.h"
+
+//////////////////////////////////////////////////////////////////////////////////
+
+static size_t g_allocations = 0;
+
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#else
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+void* operator new(size_t size) THROWS_BAD_ALLOC
+{
+	++g_allocations;
+	void *p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) throw()
+{
+	free(p);
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+
+static tstring Synthesize(const tstring &pattern, size_t count)
+{
+	const char_type *words[] = {_T("Alpha"), _T("Bravo Charlie"), _T("Delta"), _T("Echo Foxtrot Golf"),
+			_T("Hotel"), _T("India Juliet"), _T("Kilo"), _T("Lima Mike November")};
+	const size_t nWords = sizeof(words) / sizeof(words[0]);
+
+	tstring out;
+	for(size_t i = 0; i < count; ++i) {
+		tstring name = pattern;
+		const char_type *fields[] = {_T("<Artist>"), _T("<Title>"), _T("<Album>"), _T("<Genre>"),
+				_T("<Comment>"), _T("<Track#>"), _T("<Year>"), _T("<Ignore>")};
+		for(size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); ++f) {
+			tstring field(fields[f]);
+			size_t pos;
+			while((pos = name.find(field)) != tstring::npos) {
+				tstring value = words[(i * 7 + f * 3 + pos) % nWords];
+				if(field == _T("<Track#>"))
+					value = _T("0") + tstring(1, (char_type)(_T('1') + i % 9));
+				else if(field == _T("<Year>"))
+					value = _T("1999");
+				name.replace(pos, field.size(), value);
+			}
+		}
+		if(i % 10 == 9)				//make some names fail on a missing delimiter
+			name = words[i % nWords];
+		out += name;
+		out += _T('\n');
+	}
+	return out;
+}
+
+static double Seconds(const boost::posix_time::ptime &start)
+{
+	return (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+}
+
+static void Run(const tstring &pattern_str, const tstring &names, unsigned int errors, const std::vector<tstring> &equivalents)
+{
+	Pattern pattern(pattern_str, true);
+	pattern.SetTrimChars(_T(" "));
+	pattern.SetTolerance(errors, equivalents);
+
+	//Split once up front so the single-name loop measures only match()
+	std::vector<std::pair<size_t, size_t> > lines;
+	for(size_t start = 0; start < names.size(); ) {
+		size_t end = names.find(_T('\n'), start);
+		if(end == tstring::npos)
+			end = names.size();
+		if(end > start)
+			lines.push_back(std::make_pair(start, end));
+		start = end + 1;
+	}
+	if(lines.empty())
+		return;
+
+	MatchResult result;
+	size_t matched = 0;
+	size_t allocations = g_allocations;
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for(size_t i = 0; i < lines.size(); ++i)
+		matched += pattern.match(names.data() + lines[i].first, lines[i].second - lines[i].first, result);
+	double single_s = Seconds(start);
+	size_t single_allocs = g_allocations - allocations;
+
+	BatchResult batch;
+	pattern.match_batch(names.data(), names.size(), batch);	//warm up the columns
+	allocations = g_allocations;
+	start = boost::posix_time::microsec_clock::universal_time();
+	pattern.match_batch(names.data(), names.size(), batch);
+	double batch_s = Seconds(start);
+	size_t batch_allocs = g_allocations - allocations;
+
+	tcout << _T("pattern `") << pattern_str << _T("`\n")
+		<< _T("  names:   ") << lines.size() << _T(" (") << matched << _T(" matched)\n")
+		<< _T("  match:   ") << (size_t)(lines.size() / single_s) << _T(" names/s, ")
+		<< (double)single_allocs / lines.size() << _T(" allocations/match\n")
+		<< _T("  batch:   ") << (size_t)(batch.size() / batch_s) << _T(" names/s, ")
+		<< (double)batch_allocs / batch.size() << _T(" allocations/match") << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = 1000000;
+	unsigned int errors = 0;
+	std::vector<tstring> patterns, equivalents;
+	const char *names_file = NULL;
+
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "-n") && i + 1 < argc)
+			count = strtoul(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "-k") && i + 1 < argc)
+			errors = strtoul(argv[++i], NULL, 10);
+		else if(!strcmp(argv[i], "-e") && i + 1 < argc) {
+			std::string e(argv[++i]);
+			equivalents.push_back(tstring(e.begin(), e.end()));
+		}
+		else if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+			std::string p(argv[++i]);
+			patterns.push_back(tstring(p.begin(), p.end()));
+		}
+		else
+			names_file = argv[i];
+	}
+	if(patterns.empty()) {
+		patterns.push_back(_T("<Artist> - <Title>"));
+		patterns.push_back(_T("<Track#>. <Artist> - <Title>"));
+		patterns.push_back(_T("<Artist> - <Album> - <Track#> - <Title> (<Year>)"));
+		patterns.push_back(_T("<Artist> -- <Album> -- <Title>"));
+	}
+
+	try {
+		tstring names;
+		if(names_file) {
+			std::basic_ifstream<char_type> in(names_file, std::ios::binary);
+			if(!in) {
+				tcerr << _T("Cannot open ") << names_file << std::endl;
+				return -1;
+			}
+			names.assign(std::istreambuf_iterator<char_type>(in), std::istreambuf_iterator<char_type>());
+		}
+		for(std::vector<tstring>::iterator it = patterns.begin(); it != patterns.end(); ++it)
+			Run(*it, names_file ? names : Synthesize(*it, count), errors, equivalents);
+	} catch (std::exception& e) {
+		tcerr << _T("Error: ") << e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
@@ -6,6 +6,16 @@
  */
 
 #include "common.h"
+#include <cerrno>
+#include <cstdlib>
+#include <list>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/once.hpp>
+#include <boost/thread/tss.hpp>
+
+#ifndef BOOST_WINDOWS_API
+	#include <unistd.h>
+#endif
 
 Exc::Exc(std::string ss)
 : s(ss)
@@ -36,31 +46,280 @@ bool isField(tstring field)
 	return false;
 }
 
-/////////////////////////////////////////////
+unsigned long long HashBytes(const void *data, size_t size, unsigned long long seed)
+{
+	const unsigned char *p = static_cast<const unsigned char*>(data);
+	unsigned long long h = seed;
+	for(size_t i = 0; i < size; ++i) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+fs::path TempPathFor(const fs::path &file)
+{
+	fs::path tmp = file;
+	tmp += ".mp3tagger-tmp";
+	return tmp;
+}
 
-boost::mutex atomic_message::s_mtx;
+/////////////////////////////////////////////
 
 atomic_message::~atomic_message()
 {
-	boost::lock_guard<boost::mutex> lock(s_mtx);
-	tcout << boost::this_thread::get_id() <<  ">\t" << str();
-	tcout.flush();
+	log_sink::Append(_level, str());
+}
+
+/////////////////////////////////////////////
+
+namespace {
+	typedef std::basic_string<char_type> log_string;
+
+	//Flush a thread's buffer once it holds this much, otherwise every WRITER_INTERVAL_MS
+	const size_t WAKE_WRITER_BYTES = 64 * 1024;
+	const long WRITER_INTERVAL_MS = 50;
+
+	struct thread_buffer {
+		boost::mutex mtx;
+		log_string text;
+		log_string thread_id;
+		bool retired;				//owning thread has exited
+	};
+
+	//Called at thread exit; the writer frees the buffer after draining it
+	void RetireBuffer(thread_buffer *buffer)
+	{
+		boost::lock_guard<boost::mutex> lock(buffer->mtx);
+		buffer->retired = true;
+	}
+
+	boost::thread_specific_ptr<thread_buffer> g_buffer(RetireBuffer);
+	boost::mutex g_registry_mtx;
+	std::list<thread_buffer*> g_buffers;
+
+	boost::once_flag g_started = BOOST_ONCE_INIT;
+	boost::thread *g_writer = NULL;
+	bool g_stop = false;
+	bool g_stopped = false;
+	unsigned long g_flush_requested = 0;
+	unsigned long g_flush_completed = 0;
+	boost::mutex g_mtx;
+	boost::condition_variable g_wake;
+	boost::condition_variable g_flushed;
+
+	const char_type *LevelName(LogLevel level)
+	{
+		switch(level) {
+		case LevelError: return _T("error");
+		case LevelInfo: return _T("info");
+		default: return _T("debug");
+		}
+	}
+
+	void AppendJson(log_string &out, LogLevel level, const log_string &message, const log_string &thread_id)
+	{
+		//One object per message, without the trailing blank lines of the text format
+		size_t end = message.find_last_not_of(_T("\r\n"));
+		if(end == log_string::npos)
+			return;
+		std::string time = boost::posix_time::to_iso_extended_string(boost::posix_time::microsec_clock::universal_time());
+		out += _T("{\"time\":\"");
+		out.append(time.begin(), time.end());
+		out += _T("Z\",\"thread\":\"");
+		out += thread_id;
+		out += _T("\",\"level\":\"");
+		out += LevelName(level);
+		out += _T("\",\"msg\":\"");
+		for(size_t i = 0; i <= end; ++i) {
+			char_type c = message[i];
+			switch(c) {
+			case _T('"'): out += _T("\\\""); break;
+			case _T('\\'): out += _T("\\\\"); break;
+			case _T('\n'): out += _T("\\n"); break;
+			case _T('\r'): out += _T("\\r"); break;
+			case _T('\t'): out += _T("\\t"); break;
+			default:
+				if(std::char_traits<char_type>::to_int_type(c) < 0x20) {
+					const char_type *hex = _T("0123456789abcdef");
+					out += _T("\\u00");
+					out += hex[(c >> 4) & 0xF];
+					out += hex[c & 0xF];
+				} else
+					out += c;
+			}
+		}
+		out += _T("\"}\n");
+	}
+
+	log_string CollectBuffers()
+	{
+		log_string batch;
+		boost::lock_guard<boost::mutex> lock(g_registry_mtx);
+		for(std::list<thread_buffer*>::iterator it = g_buffers.begin(); it != g_buffers.end(); ) {
+			thread_buffer *buffer = *it;
+			bool retired;
+			{
+				boost::lock_guard<boost::mutex> buffer_lock(buffer->mtx);
+				batch += buffer->text;
+				buffer->text.clear();
+				retired = buffer->retired;
+			}
+			if(retired) {
+				delete buffer;
+				it = g_buffers.erase(it);
+			} else
+				++it;
+		}
+		return batch;
+	}
+
+#ifdef BOOST_WINDOWS_API
+	void WriteBatch(const log_string &batch)
+	{
+		if(batch.empty())
+			return;
+		tcout.write(batch.data(), batch.size());
+		tcout.flush();
+	}
+#else
+	void WriteBatch(const log_string &batch)
+	{
+		const char *p = batch.data();
+		size_t left = batch.size();
+		while(left) {
+			ssize_t n = ::write(STDOUT_FILENO, p, left);
+			if(n < 0) {
+				if(errno == EINTR)
+					continue;
+				return;
+			}
+			p += n;
+			left -= n;
+		}
+	}
+#endif
+}
+
+volatile LogLevel log_sink::s_level = LevelDebug;
+volatile bool log_sink::s_json = false;
+
+void log_sink::Start()
+{
+	tcout.flush();					//keep anything printed before in front of the log
+	g_writer = new boost::thread(&log_sink::_thread_func);
+	atexit(&log_sink::Shutdown);
+}
+
+void log_sink::Append(LogLevel level, const log_string &message)
+{
+	boost::call_once(g_started, &log_sink::Start);
+
+	thread_buffer *buffer = g_buffer.get();
+	if(!buffer) {
+		buffer = new thread_buffer;
+		buffer->retired = false;
+		std::basic_ostringstream<char_type> id;
+		id << boost::this_thread::get_id();
+		buffer->thread_id = id.str();
+		g_buffer.reset(buffer);
+		boost::lock_guard<boost::mutex> lock(g_registry_mtx);
+		g_buffers.push_back(buffer);
+	}
+
+	size_t buffered;
+	{
+		boost::lock_guard<boost::mutex> lock(buffer->mtx);
+		if(s_json)
+			AppendJson(buffer->text, level, message, buffer->thread_id);
+		else {
+			buffer->text += buffer->thread_id;
+			buffer->text += _T(">\t");
+			buffer->text += message;
+		}
+		buffered = buffer->text.size();
+	}
+
+	boost::lock_guard<boost::mutex> lock(g_mtx);
+	if(g_stopped)					//after Shutdown, write through
+		WriteBatch(CollectBuffers());
+	else if(buffered >= WAKE_WRITER_BYTES)
+		g_wake.notify_one();
+}
+
+void log_sink::Flush()
+{
+	boost::unique_lock<boost::mutex> lock(g_mtx);
+	if(!g_writer || g_stopped)
+		return;
+	unsigned long ticket = ++g_flush_requested;
+	g_wake.notify_one();
+	while(g_flush_completed < ticket)
+		g_flushed.wait(lock);
+}
+
+void log_sink::Shutdown()
+{
+	boost::thread *writer;
+	{
+		boost::lock_guard<boost::mutex> lock(g_mtx);
+		if(!g_writer || g_stop)
+			return;
+		g_stop = true;
+		g_wake.notify_one();
+		writer = g_writer;
+	}
+	writer->join();
+	delete writer;
+	boost::lock_guard<boost::mutex> lock(g_mtx);
+	g_writer = NULL;
+	g_stopped = true;
+	WriteBatch(CollectBuffers());
+}
+
+void log_sink::_thread_func()
+{
+	boost::unique_lock<boost::mutex> lock(g_mtx);
+	for(;;) {
+		unsigned long requested = g_flush_requested;
+		bool stop = g_stop;
+		lock.unlock();
+		WriteBatch(CollectBuffers());
+		lock.lock();
+		g_flush_completed = requested;
+		g_flushed.notify_all();
+		if(stop)
+			return;
+		if(g_flush_requested == requested && !g_stop)
+			g_wake.timed_wait(lock, boost::posix_time::milliseconds(WRITER_INTERVAL_MS));
+	}
 }
 
 /////////////////////////////////////////////
 
 #ifdef BOOST_WINDOWS_API
 	#include <windows.h>
-	void HardKill(boost::thread *thread)
+	bool SyncFile(const fs::path &file)
 	{
-		TerminateThread(thread->native_handle(), EXIT_SUCCESS);
-        return;
+		HANDLE h = CreateFileW(file.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+				NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(h == INVALID_HANDLE_VALUE)
+			return false;
+		bool ok = FlushFileBuffers(h) != 0;
+		CloseHandle(h);
+		return ok;
 	}
 
 #else
-	#include <pthread.h>
-	void HardKill(boost::thread *thread)
+	#include <fcntl.h>
+	#include <unistd.h>
+	bool SyncFile(const fs::path &file)
 	{
-		pthread_cancel(thread->native_handle());
+		int fd = ::open(file.c_str(), O_RDONLY);
+		if(fd < 0)
+			return false;
+		bool ok = fsync(fd) == 0;
+		close(fd);
+		return ok;
 	}
 #endif
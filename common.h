@@ -20,12 +20,14 @@ namespace po = boost::program_options;
     typedef wchar_t										char_type;
 	#define tcout 										std::wcout
 	#define tcerr 										std::wcerr
+	#define tcin 										std::wcin
 	#define _T(x)										L ##x
 	#define tvalue										wvalue
 #   else
     typedef char										char_type;
     #define tcout 										std::cout
 	#define tcerr 										std::cerr
+	#define tcin 										std::cin
 	#define _T(x) 										x
 	#define tvalue										value
 #   endif
@@ -34,6 +36,52 @@ namespace po = boost::program_options;
 
 bool isField(tstring field);
 
+//Flushes a written file to stable storage
+bool SyncFile(const fs::path &file);
+//Where a file is rebuilt before it is renamed over the original
+fs::path TempPathFor(const fs::path &file);
+
+//64-bit FNV-1a; pass the previous result as seed to hash several pieces
+unsigned long long HashBytes(const void *data, size_t size, unsigned long long seed = 14695981039346656037ULL);
+
+//Code points of a name: UTF-8 on POSIX (a byte that is not valid UTF-8
+//stands for itself) and UTF-16 units on Windows. Advances i past the one at i.
+inline unsigned int NextCodePoint(const char_type *s, size_t size, size_t &i)
+{
+	unsigned int c = std::char_traits<char_type>::to_int_type(s[i++]);
+	if(sizeof(char_type) > 1 || c < 0xC0 || c >= 0xF8)
+		return c;
+	size_t extra = c >= 0xF0 ? 3 : (c >= 0xE0 ? 2 : 1);
+	if(size - i < extra)
+		return c;
+	unsigned int code = c & (0x3F >> extra);
+	for(size_t k = 0; k < extra; ++k) {
+		unsigned int next = std::char_traits<char_type>::to_int_type(s[i + k]);
+		if((next & 0xC0) != 0x80)
+			return c;
+		code = code << 6 | (next & 0x3F);
+	}
+	i += extra;
+	return code;
+}
+
+//The code point ending at i, not looking before from; moves i to its start
+inline unsigned int PrevCodePoint(const char_type *s, size_t from, size_t &i)
+{
+	if(sizeof(char_type) == 1) {
+		size_t lead = i - 1;
+		while(lead > from && i - lead < 4 && (std::char_traits<char_type>::to_int_type(s[lead]) & 0xC0) == 0x80)
+			--lead;
+		size_t next = lead;
+		unsigned int code = NextCodePoint(s, i, next);
+		if(next == i) {
+			i = lead;
+			return code;
+		}
+	}
+	return std::char_traits<char_type>::to_int_type(s[--i]);
+}
+
 ////////////////////////////////////////////////////////
 
 struct Exc : public std::exception
@@ -48,25 +96,153 @@ struct Exc : public std::exception
 #define BOOST_THREAD_USE_LIB
 
 #include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <deque>
 #include <sstream>
 #include <ostream>
 #include <iostream>
 
+enum LogLevel {LevelError = 0, LevelInfo, LevelDebug};
+
+//Messages above this level are compiled out, e.g. -DLOG_MAX_LEVEL=LevelInfo
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LevelDebug
+#endif
+
+//One log message; handed to log_sink as a whole when it goes out of scope
 class atomic_message 
 	: public std::basic_ostringstream<char_type>
 {
 public:
+	explicit atomic_message(LogLevel level = LevelInfo) : _level(level) {}
     ~atomic_message();
 private:
-	static boost::mutex s_mtx;
+	LogLevel _level;
+};
+
+//Asynchronous log output.
+//Each thread appends finished messages to its own buffer; a background
+//writer collects all buffers and writes them with one write per batch.
+class log_sink
+{
+public:
+	static bool Enabled(LogLevel level) { return level <= LOG_MAX_LEVEL && level <= s_level; }
+	static void SetLevel(LogLevel level) { s_level = level; }
+	static void SetJson(bool json) { s_json = json; }
+	static void Append(LogLevel level, const std::basic_string<char_type> &message);
+	static void Flush();			//returns once everything appended so far is written
+	static void Shutdown();			//flushes and stops the writer
+private:
+	static void Start();
+	static void _thread_func();
+	static volatile LogLevel s_level;
+	static volatile bool s_json;
 };
 
 #define LogType atomic_message
-#define Log atomic_message().flush()
+#define LogAt(level) for(bool log_on_ = log_sink::Enabled(level); log_on_; log_on_ = false) atomic_message(level).flush()
+#define Log LogAt(LevelInfo)
+#define LogDebug LogAt(LevelDebug)
+#define LogError LogAt(LevelError)
 
 /////////////////////////////////////////////////////////
 
-void HardKill(boost::thread *thread);
+//Bounded blocking FIFO between the directory walk (producer) and the workers.
+//push() blocks while the queue is full so the walk is throttled by the workers,
+//pop() blocks while it is empty so idle workers sleep instead of spinning.
+//Every popped item must be acknowledged with task_done(); wait_idle() returns
+//once everything pushed so far has been acknowledged.
+//After close(), push() is refused and pop() drains what is left, then returns false.
+template <class T>
+class work_queue
+{
+public:
+	explicit work_queue(size_t capacity)
+	: _capacity(capacity ? capacity : 1)
+	, _pending(0)
+	, _closed(false)
+	{
+	}
+
+	bool push(const T &item)
+	{
+		boost::unique_lock<boost::mutex> lock(_mtx);
+		while(!_closed && _items.size() >= _capacity)
+			_not_full.wait(lock);
+		if(_closed)
+			return false;
+		_items.push_back(item);
+		++_pending;
+		_not_empty.notify_one();
+		return true;
+	}
+
+	bool pop(T &item)
+	{
+		boost::unique_lock<boost::mutex> lock(_mtx);
+		while(!_closed && _items.empty())
+			_not_empty.wait(lock);
+		if(_items.empty())
+			return false;
+		item = _items.front();
+		_items.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+
+	void task_done()
+	{
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		if(_pending && --_pending == 0)
+			_idle.notify_all();
+	}
+
+	void wait_idle()
+	{
+		boost::unique_lock<boost::mutex> lock(_mtx);
+		while(_pending)
+			_idle.wait(lock);
+	}
+
+	void close()
+	{
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		_closed = true;
+		_not_empty.notify_all();
+		_not_full.notify_all();
+	}
+
+	void reopen()
+	{
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		_closed = false;
+	}
+
+	size_t size()
+	{
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		return _items.size();
+	}
+
+	//Calls f on each of the first n items, under the lock; keep f cheap
+	template <class F>
+	void visit(size_t n, F &f)
+	{
+		boost::lock_guard<boost::mutex> lock(_mtx);
+		for(size_t i = 0; i < n && i < _items.size(); ++i)
+			f(_items[i]);
+	}
+
+private:
+	std::deque<T> _items;
+	size_t _capacity;
+	size_t _pending;				//pushed but not yet acknowledged
+	bool _closed;
+	boost::mutex _mtx;
+	boost::condition_variable _not_empty;
+	boost::condition_variable _not_full;
+	boost::condition_variable _idle;
+};
 
 
 #endif /* COMMON_H_ */
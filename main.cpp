@@ -6,6 +6,7 @@
  */
 
 #include <stdio.h>
+#include <signal.h>
 #include <string>
 #include <fstream>
 #include "boost/program_options.hpp"
@@ -13,27 +14,76 @@
 #include "FileTagger.h"
 #include "common.h"
 
+//Ends --watch on Ctrl+C or SIGTERM; the files already queued are still tagged
+static FileTagger *volatile g_tagger = NULL;
+
+static void StopOnSignal(int)
+{
+	FileTagger *tagger = g_tagger;
+	if(tagger)
+		tagger->StopWatching();
+}
 
 int main(int argc, char **argv) {
 	tstring c_directory;
-	tstring c_pattern;
+	std::vector<tstring> c_patterns;
 	tstring c_trim_chars;
+	tstring c_index;
+	tstring c_journal;
+	tstring c_catalog;
+	tstring c_build_catalog;
+	tstring c_undo;
+	tstring c_revert;
+	tstring c_metrics;
+	tstring c_list;
 	std::vector<tstring> c_empty_v;
-	bool c_trim = false, c_safe = false,  c_recursive = false;
+	bool c_trim = false, c_safe = false,  c_recursive = false, c_null = false;
 	unsigned int c_thread_count = 1;
+	unsigned int c_timeout = 0;
+	unsigned int c_metrics_interval = 10;
+	unsigned int c_debounce = 50;
+	unsigned int c_fuzzy = 0;
+	std::vector<tstring> c_equivalents;
+	size_t c_padding = Id3v2Tag::DEFAULT_PADDING;
+	bool c_watch = false;
 	/////////
 	std::string prog = "Tag Mp3 files from filename";
 	po::options_description desc(prog);
 
 	//Add options
 	desc.add_options()	("help,h", "this message")
-						("pattern,p", po::tvalue<tstring>(), "pattern to match")
+						("pattern,p", po::tvalue<std::vector<tstring> >(), "pattern to match, e.g. \"<Artist> - <Title>\", or an expression after re:; repeat to try several patterns in order, the first match wins")
+						("fuzzy", po::value<unsigned int>(&c_fuzzy), "when a delimiter is not in a name verbatim, accept it with up to this many typos (at most 3)")
+						("equivalent", po::tvalue<std::vector<tstring> >(&c_equivalents), "characters that may stand for each other in delimiters, e.g. \"-_\"; repeat for several sets")
 						("recursive,r", "recursive iteration")
 						("trim,t", po::tvalue<tstring>()->implicit_value(_T(" "), " "), "remove leading and trailing space from fields")
 						("safe,s", "safe mode, do not update files")
 						("threads", po::tvalue<unsigned int>(), "number of worker threads (default = 1)")
+						("timeout", po::tvalue<unsigned int>(), "skip writing a file if tagging it takes longer than this many seconds (default = no limit)")
+						("index", po::tvalue<tstring>(&c_index), "remember results in this file and skip files that did not change since")
+						("catalog", po::tvalue<tstring>(&c_catalog), "complete artist, album and title from this catalog, with year, genre and track")
+						("build-catalog", po::tvalue<tstring>(&c_build_catalog), "build the --catalog file from this tab separated file of artist, album, title, year, genre and track, then exit")
+						("journal", po::tvalue<tstring>(&c_journal), "journal writes in this file; after a crash, rerun with it to repair and resume")
+						("undo-log", po::tvalue<tstring>(&c_undo), "append the old tags of every file written to this log, to undo the run with --revert")
+						("revert", po::tvalue<tstring>(&c_revert), "put back the tags an undo log holds, on the worker threads, instead of tagging")
+						("metrics-file", po::tvalue<tstring>(&c_metrics), "write run metrics in Prometheus text format to this file while running")
+						("metrics-interval", po::value<unsigned int>(&c_metrics_interval), "seconds between metrics file updates (default = 10)")
+						("log-level", po::value<std::string>(), "error, info or debug (default = debug)")
+						("log-json", "write the log as JSON lines")
 						("empty,e", po::tvalue<std::vector<tstring> >(), "only update tags if the tag specified with this option is initially empty")
-						("directory,d", po::tvalue<tstring>(&c_directory)->required(), "path to folder (required)");
+						("from-file,f", po::tvalue<tstring>(&c_list), "read the paths to tag from this file as they arrive, - for stdin")
+						("padding", po::value<size_t>(&c_padding), "bytes to leave free when an ID3v2 tag has to grow, so later edits are written in place (default = 4096)")
+						("taglib", "read and write every tag through TagLib, also plain ID3v2 tags")
+						("io-uring", "read the tags of many files at once through io_uring (Linux 5.6+), falls back to the worker threads")
+						("mmap", "read ID3v2 tags by mapping them instead of reading the file head")
+						("prefetch", po::value<unsigned int>(), "how many queued files to have the kernel read ahead (default = 16 with --mmap, 0 otherwise)")
+						("dedup", "hash the audio of every file, leaving out its tags, and report files with the same audio")
+						("dedup-tags", "like --dedup, and tag every copy like the first file with its audio instead of by its own name")
+						("sniff", "look into files of unknown extensions for MP3, FLAC, MP4 or Ogg Vorbis contents")
+						("watch,w", "keep running and tag files as they are written to or moved into the directory (Linux)")
+						("debounce", po::value<unsigned int>(&c_debounce), "with --watch, milliseconds a file must stay quiet before it is tagged (default = 50)")
+						("null,0", "paths read with --from-file are separated by NUL instead of newline")
+						("directory,d", po::tvalue<tstring>(&c_directory), "path to folder (required unless --from-file is given)");
 
 	po::positional_options_description positionalOptions;
 	positionalOptions.add("directory", 1);
@@ -46,8 +96,22 @@ int main(int argc, char **argv) {
 		                vm); // throws on error
 
 		po::variables_map parameters;
+		if (vm.count("log-level")) {
+			std::string level = vm["log-level"].as<std::string>();
+			if(level == "error")
+				log_sink::SetLevel(LevelError);
+			else if(level == "info")
+				log_sink::SetLevel(LevelInfo);
+			else if(level == "debug")
+				log_sink::SetLevel(LevelDebug);
+			else
+				throw Exc(level + " is not a valid log level");
+		}
+		if (vm.count("log-json")) {
+			log_sink::SetJson(true);
+		}
 		if (vm.count("pattern")) {
-			c_pattern = vm["pattern"].as<tstring>();
+			c_patterns = vm["pattern"].as< std::vector<tstring> >();
 		}
 		if(vm.count("recursive")) {
 			c_recursive = true;
@@ -60,9 +124,18 @@ int main(int argc, char **argv) {
 			c_safe = true;
 			Log << "Safe mode is on" << std::endl;
 		}
+		if (vm.count("watch")) {
+			c_watch = true;
+		}
+		if (vm.count("null")) {
+			c_null = true;
+		}
 		if (vm.count("threads")) {
 			c_thread_count = vm["threads"].as<unsigned int>();
 		}
+		if (vm.count("timeout")) {
+			c_timeout = vm["timeout"].as<unsigned int>();
+		}
 		if (vm.count("empty")) {
 			c_empty_v = vm["empty"].as< std::vector<tstring> >();
 			for(std::vector<tstring>::iterator it = c_empty_v.begin(); it!=c_empty_v.end(); ++it) {
@@ -79,26 +152,105 @@ int main(int argc, char **argv) {
 			std::cout << desc;
 		}
 		po::notify(vm);
+		if (!c_build_catalog.empty()) {
+			if (c_catalog.empty())
+				throw Exc("--build-catalog needs --catalog to write to");
+			std::ifstream tsv(fs::path(c_build_catalog).string().c_str(), std::ios::binary);
+			if (!tsv)
+				throw Exc("Cannot open " + fs::path(c_build_catalog).string());
+			size_t rows = Catalog::Build(tsv, fs::path(c_catalog));
+			if (!rows)
+				throw Exc("No catalog written");
+			Log << _T("Catalog: ") << rows << _T(" recordings written") << std::endl;
+			log_sink::Shutdown();
+			return 0;
+		}
+		if (!c_revert.empty()) {
+			if (!c_directory.empty() || !c_list.empty() || c_watch)
+				throw Exc("--revert takes no directory, --from-file or --watch");
+			if (!c_undo.empty() || !c_journal.empty())
+				throw Exc("--revert cannot be combined with --undo-log or --journal");
+		}
+		else if (c_directory.empty() == c_list.empty())
+			throw Exc("Give either a directory or --from-file");
+		if (c_watch && c_directory.empty())
+			throw Exc("--watch needs a directory");
+		if (c_padding > Id3v2Tag::MAX_TAG_SIZE)
+			throw Exc("--padding cannot exceed 268435455 bytes, the size limit of an ID3v2 tag");
 
 		// Execute here
-		Pattern p(c_pattern, c_trim);
-		p.SetTrimChars(c_trim_chars);
-		p.print();
-		FileTagger tagger(p);
+		if(c_patterns.empty())
+			c_patterns.push_back(tstring());
+		PatternSet patterns;
+		for(std::vector<tstring>::iterator it = c_patterns.begin(); it != c_patterns.end(); ++it) {
+			Pattern &p = patterns.Add(new Pattern(*it, c_trim));
+			p.SetTrimChars(c_trim_chars);
+			p.SetTolerance(c_fuzzy, c_equivalents);
+			p.print();
+		}
+		patterns.Compile();
+		FileTagger tagger(patterns);
 		tagger.SetEmptyFieldConstraint(c_empty_v);
 		tagger.SetSafeMode(c_safe);
+		tagger.SetTaskTimeout(c_timeout);
+		tagger.SetDirectId3(!vm.count("taglib"));
+		tagger.SetPadding(c_padding);
+		tagger.SetAsyncReads(vm.count("io-uring") > 0);
+		tagger.SetMappedReads(vm.count("mmap") > 0);
+		tagger.SetSniff(vm.count("sniff") > 0);
+		tagger.SetDuplicates(vm.count("dedup") > 0, vm.count("dedup-tags") > 0);
+		tagger.SetPrefetch(vm.count("prefetch") ? vm["prefetch"].as<unsigned int>() : (vm.count("mmap") ? 16 : 0));
 		tagger.SetThreadCount(c_thread_count);
-		tagger.Tag(c_directory, c_recursive);
+		if(!c_index.empty())
+			tagger.SetIndexFile(c_index);
+		if(!c_catalog.empty() && !tagger.SetCatalog(c_catalog))
+			throw Exc("Cannot open " + fs::path(c_catalog).string());
+		if(!c_journal.empty())
+			tagger.SetJournalFile(c_journal);
+		if(!c_undo.empty())
+			tagger.SetUndoLog(c_undo);
+		if(!c_metrics.empty())
+			tagger.SetMetricsFile(c_metrics, c_metrics_interval);
+		if(!c_revert.empty()) {
+			if(!tagger.Revert(c_revert))
+				throw Exc("Cannot read " + fs::path(c_revert).string());
+		}
+		else if(c_watch) {
+			g_tagger = &tagger;
+			signal(SIGINT, StopOnSignal);
+			signal(SIGTERM, StopOnSignal);
+			bool watched = tagger.Watch(c_directory, c_recursive, c_debounce);
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+			g_tagger = NULL;
+			if(!watched)
+				throw Exc("Cannot watch " + fs::path(c_directory).string());
+		}
+		else if(c_list.empty())
+			tagger.Tag(c_directory, c_recursive);
+		else if(c_list == _T("-"))
+			tagger.TagList(tcin, c_null ? _T('\0') : _T('\n'), c_recursive);
+		else {
+			std::basic_ifstream<char_type> list(fs::path(c_list).string().c_str(), std::ios::binary);
+			if(!list)
+				throw Exc("Cannot open " + fs::path(c_list).string());
+			tagger.TagList(list, c_null ? _T('\0') : _T('\n'), c_recursive);
+		}
+		tagger.SaveIndex();
+		tagger.PrintSummary();
 		//
 	} catch (std::exception& e) {
 		if (!vm.count("help")) {
+			log_sink::Flush();
 			tcout << "Error: " << e.what() << std::endl;
 			tcout << "Try -h or --help for help." << std::endl;
+			log_sink::Shutdown();
 			return -1;
 		}
 
 	}
 
+	log_sink::Shutdown();
 	return 0;
 }
 